@@ -0,0 +1,170 @@
+#include "array.h"
+#include "seq.h"
+#include "matrix.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/*
+** Buffers
+*/
+lbuf* lbuf_new(long size) {
+    lbuf* b = malloc(sizeof(lbuf));
+    b->refs = 1;
+    b->size = size;
+    b->mapped = 0;
+    if (posix_memalign(&b->data, LBUF_ALIGN, size ? size : LBUF_ALIGN)) { abort(); }
+    return b;
+}
+
+lbuf* lbuf_mapped(void* data, long size) {
+    lbuf* b = malloc(sizeof(lbuf));
+    b->refs = 1;
+    b->size = size;
+    b->data = data;
+    b->mapped = 1;
+    return b;
+}
+
+void lbuf_release(lbuf* b) {
+    if (--b->refs > 0) { return; }
+    if (b->mapped) {
+        munmap(b->data, b->size);
+    } else {
+        free(b->data);
+    }
+    free(b);
+}
+
+/*
+** Arrays
+*/
+lval* lval_array(long n) {
+    lval* v = calloc(1, sizeof(lval));
+    v->type = LVAL_ARR;
+    v->buf = lbuf_new(sizeof(double) * n);
+    v->data = v->buf->data;
+    v->count = n;
+    return v;
+}
+
+lval* lval_array_of(const double* x, long n) {
+    lval* v = lval_array(n);
+    memcpy(v->data, x, sizeof(double) * n);
+    return v;
+}
+
+lval* lval_array_view(lval* a, long i, long n) {
+    lval* v = calloc(1, sizeof(lval));
+    v->type = LVAL_ARR;
+    v->buf = a->buf;
+    v->buf->refs++;
+    v->data = a->data + i;
+    v->count = n;
+    return v;
+}
+
+/* Array of the first element */
+lval* larr_head(lval* a) {
+    if (a->count == 0) { return lval_error("Function 'head' passed []!"); }
+    return lval_array_view(a, 0, 1);
+}
+
+/* Array of all but the first element */
+lval* larr_tail(lval* a) {
+    if (a->count == 0) { return lval_error("Function 'tail' passed []!"); }
+    return lval_array_view(a, 1, a->count - 1);
+}
+
+/*
+** Builtins
+*/
+
+/* Array of the numbers in a sequence, pulled one at a time */
+static lval* larr_from_seq(lenv* e, lseq* s) {
+
+    long n = 0, cap = 64;
+    double* x = malloc(sizeof(double) * cap);
+
+    lseq_iter* it = lseq_iter_new(s);
+    lval* v;
+    while (lseq_next(e, it, &v)) {
+        if (v->type != LVAL_NUM) {
+            lseq_iter_del(it);
+            free(x);
+            if (v->type == LVAL_ERROR) { return v; }
+            lval_del(v);
+            return lval_error("Function 'array' passed a list containing a non-number");
+        }
+        if (n == cap) {
+            cap *= 2;
+            x = realloc(x, sizeof(double) * cap);
+        }
+        x[n++] = v->value;
+        lval_del(v);
+    }
+    lseq_iter_del(it);
+
+    lval* r = lval_array_of(x, n);
+    free(x);
+    return r;
+}
+
+/* Array of a list of numbers: array {1 2 3} */
+static lval* span_array(lenv* e, lval** x, int n) {
+
+    if (x[0]->type == LVAL_SEQ) { return larr_from_seq(e, x[0]->seq); }
+
+    lval* l = x[0];
+    for (int i = 0; i < l->count; i++) {
+        if (l->cell[i]->type != LVAL_NUM) {
+            return lval_error("Function 'array' passed a list containing a non-number");
+        }
+    }
+
+    lval* r = lval_array(l->count);
+    for (int i = 0; i < l->count; i++) { r->data[i] = l->cell[i]->value; }
+    return r;
+}
+
+/* Q-Expression of the elements of an array, or of the rows of a matrix */
+static lval* span_to_list(lenv* e, lval** x, int n) {
+
+    lval* a = x[0];
+    if (a->type == LVAL_MAT) { return lmat_to_list(a); }
+    if (a->type != LVAL_ARR) { return lsig_error(&sig_to_list, 1); }
+
+    lval* r = lval_qexpr();
+    r->count = a->count;
+    r->cell = malloc(sizeof(lval*) * a->count);
+    for (int i = 0; i < a->count; i++) { r->cell[i] = lval_num(a->data[i]); }
+    return r;
+}
+
+/* Elements i up to j of an array, sharing its buffer: slice a i j */
+static lval* span_slice(lenv* e, lval** x, int n) {
+
+    lval* a = x[0];
+    double i = x[1]->value;
+    double j = x[2]->value;
+    if (i != (long)i || j != (long)j || i < 0 || i > j || j > a->count) {
+        return lval_error("Function 'slice' passed an index out of range");
+    }
+    return lval_array_view(a, i, j - i);
+}
+
+const lsig sig_array = { "array", 1, 1, { LARG_LIST }, LARG_ARR, NULL, span_array };
+const lsig sig_to_list = { "to-list", 1, 1, { LARG_ANY }, LARG_QEXPR, NULL, span_to_list };
+const lsig sig_slice = { "slice", 3, 3, { LARG_ARR, LARG_NUM, LARG_NUM }, LARG_ARR, NULL, span_slice };
+
+lval* builtin_array(lenv* e, lval* a) {
+    return lsig_call(e, &sig_array, a);
+}
+
+lval* builtin_to_list(lenv* e, lval* a) {
+    return lsig_call(e, &sig_to_list, a);
+}
+
+lval* builtin_slice(lenv* e, lval* a) {
+    return lsig_call(e, &sig_slice, a);
+}
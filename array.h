@@ -0,0 +1,55 @@
+#ifndef ARRAY_H_
+#define ARRAY_H_
+
+#include "lval.h"
+
+/*
+** Numeric arrays
+**
+**     [1 2 3]          literal
+**     array {1 2 3}    from a list or sequence of numbers
+**     to-list a        back to a Q-Expression (of rows, for a matrix)
+**     slice a i j      elements i up to (not including) j
+**
+** An array stores its elements unboxed, as doubles in one contiguous
+** buffer, rather than as a cell array of number values. The buffer is
+** reference counted and shared: an array is a window (data, count) onto
+** it, so copying an array, and taking its head, tail or a slice, never
+** copies or boxes an element. Arrays are immutable like every other value.
+*/
+#define LBUF_ALIGN 64 // Buffers start on a cache line (and any vector register)
+
+struct lbuf {
+    int refs;
+    long size;  // Bytes allocated (or mapped)
+    void* data;
+    int mapped; // Whether data is a file mapping, unmapped on release
+};
+
+lbuf* lbuf_new(long size);
+
+/* Buffer over the size bytes mapped at data by mmap */
+lbuf* lbuf_mapped(void* data, long size);
+void lbuf_release(lbuf* b);
+
+/* Array of n elements in a new buffer, left uninitialised */
+lval* lval_array(long n);
+
+/* Array of copies of the n elements at x */
+lval* lval_array_of(const double* x, long n);
+
+/* Array of the n elements of a starting at i, sharing its buffer */
+lval* lval_array_view(lval* a, long i, long n);
+
+/* Operations on the array in a (borrowed) */
+lval* larr_head(lval* a);
+lval* larr_tail(lval* a);
+
+/* Builtins */
+extern const lsig sig_array, sig_to_list, sig_slice;
+
+lval* builtin_array(lenv* e, lval* a);
+lval* builtin_to_list(lenv* e, lval* a);
+lval* builtin_slice(lenv* e, lval* a);
+
+#endif // ARRAY_H_
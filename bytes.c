@@ -0,0 +1,199 @@
+#include "bytes.h"
+#include "array.h"
+#include "str.h"
+#include "text.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+** Bytevectors
+*/
+
+/* Bytevector of all of buffer b; consumes b */
+static lval* lval_bytes_of(lbuf* b, long size) {
+    lval* v = calloc(1, sizeof(lval));
+    v->type = LVAL_BYTES;
+    v->buf = b;
+    v->bytes = b->data;
+    v->size = size;
+    return v;
+}
+
+lval* lval_bytes_view(lval* b, long i, long n) {
+    lval* v = calloc(1, sizeof(lval));
+    v->type = LVAL_BYTES;
+    v->buf = b->buf;
+    v->buf->refs++;
+    v->bytes = b->bytes + i;
+    v->size = n;
+    return v;
+}
+
+/* Let the kernel drop the pages of b's mapping holding bytes i up to j;
+** they are read back from the file if they are touched again */
+static void lbytes_release(lval* b, long i, long j) {
+
+    if (!b->buf->mapped) { return; }
+
+    // Only whole pages, so the page holding byte j stays
+    long page = sysconf(_SC_PAGESIZE);
+    long base = (long)b->buf->data;
+    long lo = ((long)b->bytes + i - base) / page * page;
+    long hi = ((long)b->bytes + j - base) / page * page;
+    if (hi > lo) { madvise((char*)b->buf->data + lo, hi - lo, MADV_DONTNEED); }
+}
+
+/*
+** Builtins
+*/
+
+/* A file, mapped rather than read: mmap-file "data.log" */
+static lval* span_mmap_file(lenv* e, lval** x, int n) {
+
+    char path[PATH_MAX];
+    if (x[0]->count >= PATH_MAX) { return lval_error("Function 'mmap-file' passed too long a path"); }
+    memcpy(path, lval_str_bytes(x[0]), x[0]->count);
+    path[x[0]->count] = '\0';
+
+    char err[PATH_MAX + 128];
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        snprintf(err, sizeof(err), "Function 'mmap-file' could not open \"%s\": %s", path, strerror(errno));
+        if (fd >= 0) { close(fd); }
+        return lval_error(err);
+    }
+
+    // An empty mapping is not allowed, but an empty buffer is
+    if (st.st_size == 0) {
+        close(fd);
+        return lval_bytes_of(lbuf_new(0), 0);
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        snprintf(err, sizeof(err), "Function 'mmap-file' could not map \"%s\": %s", path, strerror(errno));
+        return lval_error(err);
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    return lval_bytes_of(lbuf_mapped(data, st.st_size), st.st_size);
+}
+
+/* Bytevector of the bytes of a string: bytes "abc" */
+static lval* span_bytes(lenv* e, lval** x, int n) {
+    lbuf* b = lbuf_new(x[0]->count);
+    memcpy(b->data, lval_str_bytes(x[0]), x[0]->count);
+    return lval_bytes_of(b, x[0]->count);
+}
+
+/* Length of a bytevector in bytes */
+static lval* span_bytes_len(lenv* e, lval** x, int n) {
+    return lval_num(x[0]->size);
+}
+
+/* Byte i of a bytevector: bytes-ref b 0 */
+static lval* span_bytes_ref(lenv* e, lval** x, int n) {
+    double i = x[1]->value;
+    if (i != (long)i || i < 0 || i >= x[0]->size) {
+        return lval_error("Function 'bytes-ref' passed an index out of range");
+    }
+    return lval_num((unsigned char)x[0]->bytes[(long)i]);
+}
+
+/* Bytes i up to j of a bytevector, sharing its buffer: bytes-slice b i j */
+static lval* span_bytes_slice(lenv* e, lval** x, int n) {
+
+    lval* b = x[0];
+    double i = x[1]->value;
+    double j = x[2]->value;
+    if (i != (long)i || j != (long)j || i < 0 || i > j || j > b->size) {
+        return lval_error("Function 'bytes-slice' passed an index out of range");
+    }
+    return lval_bytes_view(b, i, j - i);
+}
+
+/* String of the bytes of a bytevector */
+static lval* span_bytes_str(lenv* e, lval** x, int n) {
+    if (x[0]->size > INT_MAX) {
+        return lval_error("Function 'bytes-str' passed too many bytes for a string");
+    }
+    return lval_str(x[0]->bytes, x[0]->size);
+}
+
+/* Number of non-overlapping occurrences of a pattern: bytes-count b "\n" */
+static lval* span_bytes_count(lenv* e, lval** x, int n) {
+
+    lval* b = x[0];
+    lval* pat = x[1];
+    if (pat->count == 0) { return lval_error("Function 'bytes-count' passed an empty pattern"); }
+
+    const char* p = lval_str_bytes(pat);
+    long m = pat->count;
+    long count = 0, from = 0;
+
+    for (long w = 0; w < b->size; w += LBYTES_WINDOW) {
+        long end = w + LBYTES_WINDOW < b->size ? w + LBYTES_WINDOW : b->size;
+
+        if (m == 1) {
+            count += ltext_count_chr(b->bytes + w, end - w, p[0]);
+        } else {
+            // Count the matches starting in this window, which may end in the next
+            long lim = end + m - 1 < b->size ? end + m - 1 : b->size;
+            for (long j = ltext_find(b->bytes, from, lim, p, m); j < lim;
+                 j = ltext_find(b->bytes, from, lim, p, m)) {
+                count++;
+                from = j + m;
+            }
+            if (from < end) { from = end; }
+        }
+
+        lbytes_release(b, w, end);
+    }
+
+    return lval_num(count);
+}
+
+const lsig sig_mmap_file = { "mmap-file", 1, 1, { LARG_STR }, LARG_BYTES, NULL, span_mmap_file };
+const lsig sig_bytes = { "bytes", 1, 1, { LARG_STR }, LARG_BYTES, NULL, span_bytes };
+const lsig sig_bytes_len = { "bytes-len", 1, 1, { LARG_BYTES }, LARG_NUM, NULL, span_bytes_len };
+const lsig sig_bytes_ref = { "bytes-ref", 2, 2, { LARG_BYTES, LARG_NUM }, LARG_NUM, NULL, span_bytes_ref };
+const lsig sig_bytes_slice = { "bytes-slice", 3, 3, { LARG_BYTES, LARG_NUM, LARG_NUM }, LARG_BYTES, NULL, span_bytes_slice };
+const lsig sig_bytes_str = { "bytes-str", 1, 1, { LARG_BYTES }, LARG_STR, NULL, span_bytes_str };
+const lsig sig_bytes_count = { "bytes-count", 2, 2, { LARG_BYTES, LARG_STR }, LARG_NUM, NULL, span_bytes_count };
+
+lval* builtin_mmap_file(lenv* e, lval* a) {
+    return lsig_call(e, &sig_mmap_file, a);
+}
+
+lval* builtin_bytes(lenv* e, lval* a) {
+    return lsig_call(e, &sig_bytes, a);
+}
+
+lval* builtin_bytes_len(lenv* e, lval* a) {
+    return lsig_call(e, &sig_bytes_len, a);
+}
+
+lval* builtin_bytes_ref(lenv* e, lval* a) {
+    return lsig_call(e, &sig_bytes_ref, a);
+}
+
+lval* builtin_bytes_slice(lenv* e, lval* a) {
+    return lsig_call(e, &sig_bytes_slice, a);
+}
+
+lval* builtin_bytes_str(lenv* e, lval* a) {
+    return lsig_call(e, &sig_bytes_str, a);
+}
+
+lval* builtin_bytes_count(lenv* e, lval* a) {
+    return lsig_call(e, &sig_bytes_count, a);
+}
@@ -0,0 +1,44 @@
+#ifndef BYTES_H_
+#define BYTES_H_
+
+#include "lval.h"
+
+/*
+** Bytevectors
+**
+**     mmap-file "path"        the contents of a file, mapped read-only
+**     bytes s                 the bytes of a string (copied)
+**     bytes-len b             length in bytes
+**     bytes-ref b i           byte i, as a number from 0 to 255
+**     bytes-slice b i j       bytes i up to (not including) j
+**     bytes-str b             the bytes as a string (copied)
+**     bytes-count b pat       number of (non-overlapping) pats in b
+**
+** A bytevector is a window (bytes, size) onto a reference counted buffer
+** (see array.h), like an array but of bytes and with a length that may
+** exceed an int. mmap-file maps the file rather than reading it, so it
+** copies nothing; slices share the mapping, which is unmapped when the
+** last bytevector viewing it is deleted.
+**
+** bytes-count scans in LBYTES_WINDOW sized windows, and tells the kernel
+** it may drop the pages of a mapping behind each window, so counting
+** through a file of any size keeps only about a window of it resident.
+*/
+#define LBYTES_WINDOW (64L << 20)
+
+/* Bytevector of the n bytes of b starting at i, sharing its buffer */
+lval* lval_bytes_view(lval* b, long i, long n);
+
+/* Builtins */
+extern const lsig sig_mmap_file, sig_bytes, sig_bytes_len, sig_bytes_ref,
+                  sig_bytes_slice, sig_bytes_str, sig_bytes_count;
+
+lval* builtin_mmap_file(lenv* e, lval* a);
+lval* builtin_bytes(lenv* e, lval* a);
+lval* builtin_bytes_len(lenv* e, lval* a);
+lval* builtin_bytes_ref(lenv* e, lval* a);
+lval* builtin_bytes_slice(lenv* e, lval* a);
+lval* builtin_bytes_str(lenv* e, lval* a);
+lval* builtin_bytes_count(lenv* e, lval* a);
+
+#endif // BYTES_H_
@@ -0,0 +1,43 @@
+#include "grammar.h"
+
+/* Parsers shared by the REPL and the compiler */
+static mpc_parser_t* Number;
+static mpc_parser_t* Symbol;
+static mpc_parser_t* Array;
+static mpc_parser_t* String;
+static mpc_parser_t* Sexpression;
+static mpc_parser_t* Qexpression;
+static mpc_parser_t* Expression;
+static mpc_parser_t* Lisps; // Overall rule for Lisp line
+
+mpc_parser_t* grammar_new(void) {
+
+    // Define Parsers
+    Number = mpc_new("number");
+    Symbol = mpc_new("symbol");
+    Array = mpc_new("array");
+    String = mpc_new("string");
+    Sexpression = mpc_new("sexpression");
+    Qexpression = mpc_new("qexpression");
+    Expression = mpc_new("expression");
+    Lisps = mpc_new("lisps");
+
+    // Define Grammar
+    mpca_lang(MPCA_LANG_DEFAULT, " \
+number: /-?[0-9]+(\\.[0-9]+)?/ ; \
+symbol: /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&^%?]+/ ; \
+array: '[' <number>* ']' ; \
+string: /\"(\\\\.|[^\"])*\"/ ; \
+sexpression: '(' <expression>* ')' ; \
+qexpression: '{' <expression>* '}' ; \
+expression: <number> | <symbol> | <array> | <string> | <sexpression> | <qexpression> ; \
+lisps: /^/ <expression>* /$/ ; \
+    ",
+    Number, Symbol, Array, String, Sexpression, Qexpression, Expression, Lisps);
+
+    return Lisps;
+}
+
+void grammar_cleanup(void) {
+    mpc_cleanup(8, Number, Symbol, Array, String, Sexpression, Qexpression, Expression, Lisps);
+}
@@ -0,0 +1,12 @@
+#ifndef GRAMMAR_H_
+#define GRAMMAR_H_
+
+#include "mpc.h"
+
+/* Build the Jispy grammar and return the top level "lisps" parser */
+mpc_parser_t* grammar_new(void);
+
+/* Release every parser created by grammar_new */
+void grammar_cleanup(void);
+
+#endif // GRAMMAR_H_
@@ -0,0 +1,321 @@
+#include "hcons.h"
+#include "lambda.h"
+#include "record.h"
+#include "str.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+** Table of canonical nodes
+**
+** Open addressing with linear probing. Entries are weak: a node leaves the
+** table when its reference count drops to zero.
+*/
+static lval** table = NULL;
+static unsigned long table_cap = 0;
+static unsigned long table_size = 0;
+
+#define HCONS_MIX 0x9E3779B97F4A7C15UL
+
+static unsigned long hash_mix(unsigned long h, unsigned long x) {
+    h ^= x + HCONS_MIX + (h << 6) + (h >> 2);
+    return h;
+}
+
+unsigned long lval_hash(lval* v) {
+
+    if (v->refs > 0) { return v->hash; }
+
+    unsigned long h = hash_mix(0, v->type);
+
+    switch(v->type) {
+        case LVAL_NUM: {
+            // -0 == 0, so both hash as 0
+            float x = v->value == 0 ? 0 : v->value;
+            unsigned int bits;
+            memcpy(&bits, &x, sizeof(bits));
+            h = hash_mix(h, bits);
+            break;
+        }
+        case LVAL_SYM:
+        case LVAL_ERROR: {
+            char* s = v->type == LVAL_SYM ? v->sym : v->err;
+            for (; *s; s++) { h = hash_mix(h, (unsigned char)*s); }
+            break;
+        }
+        case LVAL_REC:
+            h = hash_mix(h, (unsigned long)v->rec);
+            /* fall through */
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            h = hash_mix(h, v->count);
+            for (int i = 0; i < v->count; i++) {
+                h = hash_mix(h, lval_hash(v->cell[i]));
+            }
+            break;
+        case LVAL_FUN:
+            h = hash_mix(h, (unsigned long)v->fun);
+            h = hash_mix(h, (unsigned long)v->proto);
+            h = hash_mix(h, (unsigned long)v->rec + v->field);
+            break;
+        case LVAL_SEQ:
+            h = hash_mix(h, (unsigned long)v->seq);
+            break;
+        case LVAL_MAP:
+        case LVAL_SET:
+            // Tables are mutable, so only the same table is equal
+            h = hash_mix(h, (unsigned long)v->map);
+            break;
+        case LVAL_MAT:
+            h = hash_mix(h, v->cols);
+            /* fall through */
+        case LVAL_ARR:
+            h = hash_mix(h, v->count);
+            for (int i = 0; i < v->count; i++) {
+                double x = v->data[i] == 0 ? 0 : v->data[i];
+                unsigned long bits;
+                memcpy(&bits, &x, sizeof(bits));
+                h = hash_mix(h, bits);
+            }
+            break;
+        case LVAL_BYTES:
+            h = hash_mix(h, v->size);
+            for (long i = 0; i < v->size; i++) { h = hash_mix(h, (unsigned char)v->bytes[i]); }
+            break;
+        case LVAL_STR: {
+            const char* s = lval_str_bytes(v);
+            h = hash_mix(h, v->count);
+            for (int i = 0; i < v->count; i++) { h = hash_mix(h, (unsigned char)s[i]); }
+            break;
+        }
+    }
+
+    return h;
+}
+
+int lval_eq(lval* a, lval* b) {
+
+    // Numbers compare by value, so -0 equals 0 and NaN equals nothing
+    if (a->type == LVAL_NUM && b->type == LVAL_NUM) { return a->value == b->value; }
+
+    if (a == b) { return 1; }
+
+    // Canonical nodes are unique per structure
+    if (a->refs > 0 && b->refs > 0) { return 0; }
+
+    if (a->type != b->type) { return 0; }
+
+    switch(a->type) {
+        case LVAL_SYM:
+            return strcmp(a->sym, b->sym) == 0;
+        case LVAL_ERROR:
+            return strcmp(a->err, b->err) == 0;
+        case LVAL_REC:
+            if (a->rec != b->rec) { return 0; }
+            /* fall through */
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            if (a->count != b->count) { return 0; }
+            for (int i = 0; i < a->count; i++) {
+                if (!lval_eq(a->cell[i], b->cell[i])) { return 0; }
+            }
+            return 1;
+        case LVAL_FUN:
+            if (a->fun != b->fun || a->proto != b->proto) { return 0; }
+            if (a->rec != b->rec || a->field != b->field) { return 0; }
+            for (int i = 0; a->proto && i < a->proto->ncaptured; i++) {
+                if (!lval_eq(a->env[i], b->env[i])) { return 0; }
+            }
+            return 1;
+        case LVAL_SEQ:
+            return a->seq == b->seq;
+        case LVAL_MAP:
+        case LVAL_SET:
+            return a->map == b->map;
+        case LVAL_MAT:
+            if (a->rows != b->rows || a->cols != b->cols) { return 0; }
+            /* fall through */
+        case LVAL_ARR:
+            if (a->count != b->count) { return 0; }
+            for (int i = 0; i < a->count; i++) {
+                if (a->data[i] != b->data[i]) { return 0; }
+            }
+            return 1;
+        case LVAL_STR:
+            return a->count == b->count
+                && memcmp(lval_str_bytes(a), lval_str_bytes(b), a->count) == 0;
+        case LVAL_BYTES:
+            return a->size == b->size && memcmp(a->bytes, b->bytes, a->size) == 0;
+    }
+
+    return 0;
+}
+
+/* Children of canonical nodes are canonical, so compare them by pointer */
+static int hcons_match(lval* a, lval* b) {
+
+    if (a->type != b->type) { return 0; }
+
+    switch(a->type) {
+        case LVAL_NUM:
+            return a->value == b->value;
+        case LVAL_SYM:
+            return strcmp(a->sym, b->sym) == 0;
+        case LVAL_REC:
+            if (a->rec != b->rec) { return 0; }
+            /* fall through */
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            if (a->count != b->count) { return 0; }
+            for (int i = 0; i < a->count; i++) {
+                if (a->cell[i] != b->cell[i]) { return 0; }
+            }
+            return 1;
+        case LVAL_STR:
+            return a->count == b->count
+                && memcmp(lval_str_bytes(a), lval_str_bytes(b), a->count) == 0;
+    }
+
+    return 0;
+}
+
+static void hcons_grow(void) {
+
+    unsigned long old_cap = table_cap;
+    lval** old = table;
+
+    table_cap = old_cap ? old_cap * 2 : 1024;
+    table = calloc(table_cap, sizeof(lval*));
+
+    for (unsigned long i = 0; i < old_cap; i++) {
+        if (!old[i]) { continue; }
+        unsigned long j = old[i]->hash & (table_cap - 1);
+        while (table[j]) { j = (j + 1) & (table_cap - 1); }
+        table[j] = old[i];
+    }
+
+    free(old);
+}
+
+lval* lval_hcons(lval* v) {
+
+    if (v->refs > 0) { return v; }
+
+    switch(v->type) {
+        case LVAL_NUM:
+            // NaN equals nothing, not even a shared copy of itself
+            if (v->value != v->value) { return v; }
+            if (v->value == 0) { v->value = 0; }
+            break;
+        case LVAL_STR:
+            break;
+        case LVAL_SYM:
+            // Locals of a function are bound to its frames; never share them
+            if (v->fn) { return v; }
+            break;
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+        case LVAL_REC: {
+            // A container is shareable only if all of its children are
+            int shared = 1;
+            for (int i = 0; i < v->count; i++) {
+                v->cell[i] = lval_hcons(v->cell[i]);
+                shared = shared && v->cell[i]->refs > 0;
+            }
+            if (!shared) { return v; }
+            break;
+        }
+        default:
+            return v;
+    }
+
+    unsigned long h = lval_hash(v);
+
+    if (2 * (table_size + 1) > table_cap) { hcons_grow(); }
+
+    unsigned long i = h & (table_cap - 1);
+    while (table[i]) {
+        if (table[i]->hash == h && hcons_match(table[i], v)) {
+            lval* c = table[i];
+            c->refs++;
+            // Checks are a property of the structure, so keep any found on v
+            if (!c->checked) { c->checked = v->checked; }
+            lval_del(v);
+            return c;
+        }
+        i = (i + 1) & (table_cap - 1);
+    }
+
+    v->refs = 1;
+    v->hash = h;
+    table[i] = v;
+    table_size++;
+    return v;
+}
+
+void lval_hcons_remove(lval* v) {
+
+    unsigned long mask = table_cap - 1;
+    unsigned long i = v->hash & mask;
+    while (table[i] != v) { i = (i + 1) & mask; }
+
+    // Backward shift deletion keeps probe sequences intact
+    unsigned long j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        if (!table[j]) { break; }
+        unsigned long k = table[j]->hash & mask;
+        int movable = i <= j ? (k <= i || k > j) : (k <= i && k > j);
+        if (movable) {
+            table[i] = table[j];
+            i = j;
+        }
+    }
+
+    table[i] = NULL;
+    table_size--;
+}
+
+lval* lval_own(lval* v) {
+
+    if (v->refs == 0) { return v; }
+
+    // Shallow copy: the children stay shared
+    lval* c = calloc(1, sizeof(lval));
+    c->type = v->type;
+    c->checked = v->checked;
+
+    switch(v->type) {
+        case LVAL_NUM:
+            c->value = v->value;
+            break;
+        case LVAL_SYM:
+            c->sym = malloc(strlen(v->sym) + 1);
+            strcpy(c->sym, v->sym);
+            c->slot = v->slot;
+            c->local = v->local;
+            c->fn = v->fn;
+            break;
+        case LVAL_REC:
+            c->rec = v->rec;
+            c->rec->refs++;
+            /* fall through */
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            c->count = v->count;
+            c->cell = malloc(sizeof(lval*) * v->count);
+            for (int i = 0; i < v->count; i++) {
+                c->cell[i] = lval_copy(v->cell[i]);
+            }
+            break;
+        case LVAL_STR:
+            c->count = v->count;
+            memcpy(c->sso, v->sso, sizeof(c->sso));
+            c->str = v->str;
+            if (c->str) { c->str->refs++; }
+            break;
+    }
+
+    lval_del(v);
+    return c;
+}
@@ -0,0 +1,32 @@
+#ifndef HCONS_H_
+#define HCONS_H_
+
+#include "lval.h"
+
+/*
+** Hash-consing
+**
+** Structurally identical numbers, symbols, Q-Expressions and records are
+** stored once as a canonical node shared by reference count (lval->refs). A
+** shared node must never be mutated: lval_copy only takes another reference
+** and any code that changes a value it did not build itself calls lval_own
+** first.
+**
+** Reading a literal of 50000 copies of a 20 number list builds 0.4 MB of
+** nodes instead of 78 MB. With no repeats the table costs about 20% more.
+*/
+
+/* Consume v and return its canonical node (v itself if it can't be shared) */
+lval* lval_hcons(lval* v);
+
+/* Return a private, mutable version of v, releasing v if it was shared */
+lval* lval_own(lval* v);
+
+/* Structural hash and equality; O(1) when both sides are canonical */
+unsigned long lval_hash(lval* v);
+int lval_eq(lval* a, lval* b);
+
+/* Called by lval_del when the last reference to a canonical node dies */
+void lval_hcons_remove(lval* v);
+
+#endif // HCONS_H_
@@ -0,0 +1,525 @@
+#include "iter.h"
+#include "hcons.h"
+#include "seq.h"
+#include "lambda.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Call f (borrowed) on the single argument x */
+static lval* iter_call1(lenv* e, lval* f, lval* x) {
+    return lval_apply(e, lval_copy(f), lval_add(lval_sexpr(), x));
+}
+
+/* Call f (borrowed) on the arguments x and y */
+static lval* iter_call2(lenv* e, lval* f, lval* x, lval* y) {
+    return lval_apply(e, lval_copy(f), lval_add(lval_add(lval_sexpr(), x), y));
+}
+
+lval* iter_take(lval* l, int i) {
+    if (l->refs > 0) { return lval_copy(l->cell[i]); }
+    lval* x = l->cell[i];
+    l->cell[i] = NULL;
+    return x;
+}
+
+void iter_free(lval* l) {
+    if (l->refs == 0) {
+        for (int i = 0; i < l->count; i++) {
+            if (l->cell[i]) { lval_del(l->cell[i]); }
+        }
+        l->count = 0;
+    }
+    lval_del(l);
+}
+
+/* Apply a function to every element: map f {xs} */
+static lval* span_map(lenv* e, lval** x, int n) {
+
+    if (x[1]->type == LVAL_SEQ) { return lseq_map(x[0], x[1]); }
+
+    lval* f = x[0];
+    lval* l = x[1];
+    x[1] = NULL;
+
+    // A shared list is left alone and the results go in a new one
+    lval* out = l;
+    if (l->refs > 0) {
+        out = lval_qexpr();
+        out->cell = malloc(sizeof(lval*) * l->count);
+    }
+
+    for (int i = 0; i < l->count; i++) {
+        lval* r = iter_call1(e, f, iter_take(l, i));
+        if (r->type == LVAL_ERROR) {
+            if (out != l) { lval_del(out); }
+            iter_free(l);
+            return r;
+        }
+        out->cell[i] = r;
+        if (out != l) { out->count++; }
+    }
+
+    if (out != l) { lval_del(l); }
+    return out;
+}
+
+/* Keep the elements a predicate holds for: filter p {xs} */
+static lval* span_filter(lenv* e, lval** x, int n) {
+
+    if (x[1]->type == LVAL_SEQ) { return lseq_filter(x[0], x[1]); }
+
+    lval* p = x[0];
+    lval* l = x[1];
+    x[1] = NULL;
+
+    lval* out = l;
+    if (l->refs > 0) {
+        out = lval_qexpr();
+        out->cell = malloc(sizeof(lval*) * l->count);
+    }
+
+    // Kept elements are compacted to the front of out; in place, the slots
+    // between the last kept element and i are empty
+    int kept = 0;
+    for (int i = 0; i < l->count; i++) {
+        lval* v = l->cell[i];
+        lval* r = iter_call1(e, p, lval_copy(v));
+
+        if (r->type != LVAL_NUM) {
+            if (r->type != LVAL_ERROR) {
+                lval_del(r);
+                r = lval_error("Function 'filter' predicate did not return a number");
+            }
+            if (out != l) {
+                out->count = kept;
+                lval_del(out);
+            }
+            iter_free(l);
+            return r;
+        }
+
+        int keep = r->value != 0;
+        lval_del(r);
+
+        if (out == l) {
+            l->cell[i] = NULL;
+            if (keep) { out->cell[kept++] = v; } else { lval_del(v); }
+        } else if (keep) {
+            out->cell[kept++] = lval_copy(v);
+        }
+    }
+
+    if (out != l) { lval_del(l); }
+    out->count = kept;
+    out->cell = realloc(out->cell, sizeof(lval*) * kept);
+    return out;
+}
+
+/* Combine the elements from the left with an accumulator: fold f z {xs} */
+static lval* span_fold(lenv* e, lval** x, int n) {
+
+    if (x[2]->type == LVAL_SEQ) {
+        lval* acc = x[1];
+        x[1] = NULL;
+        return lseq_fold(e, x[0], acc, x[2]);
+    }
+
+    lval* f = x[0];
+    lval* acc = x[1];
+    lval* l = x[2];
+    x[1] = x[2] = NULL;
+
+    for (int i = 0; i < l->count; i++) {
+        acc = iter_call2(e, f, acc, iter_take(l, i));
+        if (acc->type == LVAL_ERROR) {
+            iter_free(l);
+            return acc;
+        }
+    }
+
+    iter_free(l);
+    return acc;
+}
+
+/* Call a function on every element for its effect: each f {xs} */
+static lval* span_each(lenv* e, lval** x, int n) {
+
+    if (x[1]->type == LVAL_SEQ) { return lseq_each(e, x[0], x[1]); }
+
+    lval* f = x[0];
+    lval* l = x[1];
+    x[1] = NULL;
+
+    for (int i = 0; i < l->count; i++) {
+        lval* r = iter_call1(e, f, iter_take(l, i));
+        if (r->type == LVAL_ERROR) {
+            iter_free(l);
+            return r;
+        }
+        lval_del(r);
+    }
+
+    iter_free(l);
+    return lval_sexpr();
+}
+
+/* Keep the first n elements: take n {xs} */
+static lval* span_take(lenv* e, lval** x, int n) {
+
+    // Clamp while still a double, as converting one out of range is undefined
+    double v = x[0]->value;
+    if (x[1]->type == LVAL_SEQ) {
+        return lseq_take(v > 0 ? (v < LONG_MAX ? (long)v : LONG_MAX) : 0, x[1]);
+    }
+
+    lval* l = lval_own(x[1]);
+    x[1] = NULL;
+
+    int k = v > 0 ? (v < l->count ? (int)v : l->count) : 0;
+
+    if (k == l->count) { return l; }
+
+    // Drop the tail in one pass and shrink the cell array once
+    for (int i = k; i < l->count; i++) { lval_del(l->cell[i]); }
+    l->count = k;
+    l->cell = realloc(l->cell, sizeof(lval*) * (k ? k : 1));
+    return l;
+}
+
+/*
+** Fused pipelines
+**
+** lval_fuse (opt.c) rewrites a chain such as
+**
+**     (fold f z (map g (filter p xs)))
+**
+** to (pipeline {fold map filter} f z g p xs), keeping the arguments in
+** their original order. The pipeline passes each element of xs through
+** every stage before taking the next, so no intermediate list is built,
+** and stops pulling elements once a take stage is full.
+**
+** The stage names are looked up when the pipeline runs. If any of them is
+** no longer the builtin of that name, or the arguments are not of the
+** types the stages need, the stages are called one after another exactly
+** as written instead.
+*/
+static const struct {
+    char* name;
+    lbuiltin fun;
+    int nargs; // Arguments before the list
+} stages[] = {
+    { "map", builtin_map, 1 },
+    { "filter", builtin_filter, 1 },
+    { "take", builtin_take, 1 },
+    { "fold", builtin_fold, 2 },
+};
+
+int lstage_find(lval* k) {
+    if (k->type != LVAL_SYM) { return -1; }
+    for (int i = 0; i < sizeof(stages) / sizeof(stages[0]); i++) {
+        if (strcmp(k->sym, stages[i].name) == 0) { return i; }
+    }
+    return -1;
+}
+
+lbuiltin lstage_builtin(int s) {
+    return stages[s].fun;
+}
+
+int lstage_args(int s) {
+    return stages[s].nargs;
+}
+
+/* Call the stages one after another on the list xs, innermost first */
+static lval* pipeline_unfused(lenv* e, lval** x, int n, int* kinds, int* first, int nstages) {
+
+    lval* v = x[n-1];
+    x[n-1] = NULL;
+
+    for (int k = nstages - 1; k >= 0; k--) {
+        lval* a = lval_sexpr();
+        for (int i = 0; i < stages[kinds[k]].nargs; i++) {
+            lval_add(a, x[first[k] + i]);
+            x[first[k] + i] = NULL;
+        }
+        lval_add(a, v);
+
+        lval* f = lenv_get(e, x[0]->cell[k]);
+        if (f->type != LVAL_FUN) {
+            lval_del(a);
+            if (f->type == LVAL_ERROR) { return f; }
+            lval_del(f);
+            return lval_error("first element is not a function");
+        }
+
+        v = lval_apply(e, f, a);
+        if (v->type == LVAL_ERROR) { return v; }
+    }
+    return v;
+}
+
+static lval* span_pipeline(lenv* e, lval** x, int n) {
+
+    lval* names = x[0];
+    int nstages = names->count;
+    int kinds[nstages ? nstages : 1];
+    int first[nstages ? nstages : 1]; // Position of each stage's arguments in x
+    int nargs = 1;
+    int fold = 0; // Only the outermost stage may be a fold
+
+    for (int k = 0; k < nstages; k++) {
+        kinds[k] = lstage_find(names->cell[k]);
+        if (kinds[k] < 0 || (kinds[k] == LSTAGE_FOLD && k > 0)) {
+            return lval_error("Function 'pipeline' passed an unknown stage");
+        }
+        if (kinds[k] == LSTAGE_FOLD) { fold = 1; }
+        first[k] = nargs;
+        nargs += stages[kinds[k]].nargs;
+    }
+    if (nstages == 0 || n != nargs + 1) {
+        return lval_error("Function 'pipeline' passed wrong number of arguments");
+    }
+
+    // Fuse only if every stage is still the builtin and its arguments fit
+    int fused = x[n-1]->type == LVAL_QEXPR;
+    for (int k = 0; k < nstages && fused; k++) {
+        lval* f = lenv_get(e, names->cell[k]);
+        fused = f->type == LVAL_FUN && f->fun == stages[kinds[k]].fun && !f->memo;
+        lval_del(f);
+
+        lval* arg = x[first[k]];
+        fused = fused && (kinds[k] == LSTAGE_TAKE ? arg->type == LVAL_NUM : arg->type == LVAL_FUN);
+    }
+    if (!fused) { return pipeline_unfused(e, x, n, kinds, first, nstages); }
+
+    int last = fold ? 1 : 0; // Outermost stage applied to each element
+
+    // Elements left to pass each take stage
+    long left[nstages];
+    int done = 0;
+    for (int k = 0; k < nstages; k++) {
+        double v = kinds[k] == LSTAGE_TAKE ? x[first[k]]->value : 0;
+        left[k] = v > 0 ? (v < LONG_MAX ? (long)v : LONG_MAX) : 0;
+        if (kinds[k] == LSTAGE_TAKE && left[k] == 0) { done = 1; }
+    }
+
+    lval* l = x[n-1];
+    x[n-1] = NULL;
+
+    lval* acc = NULL;
+    lval* out = NULL;
+    if (fold) {
+        acc = x[2];
+        x[2] = NULL;
+    } else {
+        out = lval_qexpr();
+        out->cell = malloc(sizeof(lval*) * l->count);
+    }
+
+    lval* err = NULL;
+    for (int i = 0; i < l->count && !done && !err; i++) {
+        lval* v = iter_take(l, i);
+
+        for (int k = nstages - 1; k >= last && v; k--) {
+            lval* f = x[first[k]];
+            switch (kinds[k]) {
+                case LSTAGE_MAP:
+                    v = iter_call1(e, f, v);
+                    if (v->type == LVAL_ERROR) { err = v; v = NULL; }
+                    break;
+                case LSTAGE_FILTER: {
+                    lval* r = iter_call1(e, f, lval_copy(v));
+                    if (r->type != LVAL_NUM) {
+                        err = r->type == LVAL_ERROR ? r
+                            : lval_error("Function 'filter' predicate did not return a number");
+                        if (err != r) { lval_del(r); }
+                    } else if (r->value != 0) {
+                        lval_del(r);
+                        break;
+                    } else {
+                        lval_del(r);
+                    }
+                    lval_del(v);
+                    v = NULL;
+                    break;
+                }
+                case LSTAGE_TAKE:
+                    if (--left[k] == 0) { done = 1; }
+                    break;
+            }
+        }
+        if (!v) { continue; }
+
+        if (fold) {
+            acc = iter_call2(e, x[1], acc, v);
+            if (acc->type == LVAL_ERROR) { err = acc; acc = NULL; }
+        } else {
+            out->cell[out->count++] = v;
+        }
+    }
+
+    iter_free(l);
+    if (err) {
+        if (acc) { lval_del(acc); }
+        if (out) { lval_del(out); }
+        return err;
+    }
+    if (fold) { return acc; }
+
+    out->cell = realloc(out->cell, sizeof(lval*) * out->count);
+    return out;
+}
+
+const lsig sig_map = { "map", 2, 2, { LARG_FUN, LARG_LIST }, LARG_LIST, NULL, span_map };
+const lsig sig_filter = { "filter", 2, 2, { LARG_FUN, LARG_LIST }, LARG_LIST, NULL, span_filter };
+const lsig sig_fold = { "fold", 3, 3, { LARG_FUN, LARG_ANY, LARG_LIST }, LARG_ANY, NULL, span_fold };
+const lsig sig_each = { "each", 2, 2, { LARG_FUN, LARG_LIST }, LARG_ANY, NULL, span_each };
+const lsig sig_take = { "take", 2, 2, { LARG_NUM, LARG_LIST }, LARG_LIST, NULL, span_take };
+const lsig sig_pipeline = { "pipeline", 2, LSIG_VARIADIC, { LARG_QEXPR, LARG_ANY }, LARG_ANY, NULL, span_pipeline };
+
+/*
+** Loops
+**
+** The condition and body are Q-Expressions evaluated in the current call
+** frame, so they read and assign (with =) the locals of the function they
+** appear in. Each iteration evaluates the same body in place with
+** lval_eval_code, which copies only the S-Expressions it reduces and the
+** values it returns, never the body as a whole.
+*/
+
+/* Evaluate code q (borrowed) once in the current frame */
+static lval* loop_run(lenv* e, lval* q) {
+    return lval_eval_code(e, q);
+}
+
+/* Evaluate the condition q; sets *holds, or returns an error */
+static lval* loop_test(lenv* e, lval* q, int* holds) {
+    lval* r = loop_run(e, q);
+    if (r->type == LVAL_NUM) {
+        *holds = r->value != 0;
+        lval_del(r);
+        return NULL;
+    }
+    if (r->type == LVAL_ERROR) { return r; }
+    lval_del(r);
+    return lval_error("Function 'while' condition did not return a number");
+}
+
+/* Run the body for as long as the condition holds: while {cond} {body} */
+static lval* span_while(lenv* e, lval** x, int n) {
+
+    int holds;
+    while (1) {
+        lval* err = loop_test(e, x[0], &holds);
+        if (err) { return err; }
+        if (!holds) { break; }
+
+        lval* r = loop_run(e, x[1]);
+        if (r->type == LVAL_ERROR) { return r; }
+        lval_del(r);
+    }
+
+    return lval_sexpr();
+}
+
+/* Run the body a number of times: do-times n {body} */
+static lval* span_do_times(lenv* e, lval** x, int n) {
+
+    // Saturated while still a double, as converting one out of range is undefined
+    double v = x[0]->value;
+    long k = v > 0 ? (v < LONG_MAX ? (long)v : LONG_MAX) : 0;
+    for (long i = 0; i < k; i++) {
+        lval* r = loop_run(e, x[1]);
+        if (r->type == LVAL_ERROR) { return r; }
+        lval_del(r);
+    }
+
+    return lval_sexpr();
+}
+
+/* Bind v to k and run the body; consumes v */
+static lval* loop_step(lenv* e, lval* k, lval* v, lval* body) {
+    lenv_assign(e, k, v);
+    lval_del(v);
+    return loop_run(e, body);
+}
+
+/* Run the body with a symbol bound to each element: for-each {x} xs {body} */
+static lval* span_for_each(lenv* e, lval** x, int n) {
+
+    if (x[0]->count != 1 || x[0]->cell[0]->type != LVAL_SYM) {
+        return lval_error("Function 'for-each' expects a single symbol to bind");
+    }
+    lval* k = x[0]->cell[0];
+
+    if (x[1]->type == LVAL_SEQ) {
+        lseq_iter* it = lseq_iter_new(x[1]->seq);
+        lval* v;
+        while (lseq_next(e, it, &v)) {
+            lval* r = v->type == LVAL_ERROR ? v : loop_step(e, k, v, x[2]);
+            if (r->type == LVAL_ERROR) {
+                lseq_iter_del(it);
+                return r;
+            }
+            lval_del(r);
+        }
+        lseq_iter_del(it);
+        return lval_sexpr();
+    }
+
+    lval* l = x[1];
+    x[1] = NULL;
+
+    for (int i = 0; i < l->count; i++) {
+        lval* r = loop_step(e, k, iter_take(l, i), x[2]);
+        if (r->type == LVAL_ERROR) {
+            iter_free(l);
+            return r;
+        }
+        lval_del(r);
+    }
+
+    iter_free(l);
+    return lval_sexpr();
+}
+
+const lsig sig_while = { "while", 2, 2, { LARG_QEXPR, LARG_QEXPR }, LARG_ANY, NULL, span_while };
+const lsig sig_do_times = { "do-times", 2, 2, { LARG_NUM, LARG_QEXPR }, LARG_ANY, NULL, span_do_times };
+const lsig sig_for_each = { "for-each", 3, 3, { LARG_QEXPR, LARG_LIST, LARG_QEXPR }, LARG_ANY, NULL, span_for_each };
+
+lval* builtin_while(lenv* e, lval* a) {
+    return lsig_call(e, &sig_while, a);
+}
+
+lval* builtin_do_times(lenv* e, lval* a) {
+    return lsig_call(e, &sig_do_times, a);
+}
+
+lval* builtin_for_each(lenv* e, lval* a) {
+    return lsig_call(e, &sig_for_each, a);
+}
+
+lval* builtin_map(lenv* e, lval* a) {
+    return lsig_call(e, &sig_map, a);
+}
+
+lval* builtin_filter(lenv* e, lval* a) {
+    return lsig_call(e, &sig_filter, a);
+}
+
+lval* builtin_fold(lenv* e, lval* a) {
+    return lsig_call(e, &sig_fold, a);
+}
+
+lval* builtin_each(lenv* e, lval* a) {
+    return lsig_call(e, &sig_each, a);
+}
+
+lval* builtin_take(lenv* e, lval* a) {
+    return lsig_call(e, &sig_take, a);
+}
+
+lval* builtin_pipeline(lenv* e, lval* a) {
+    return lsig_call(e, &sig_pipeline, a);
+}
@@ -0,0 +1,419 @@
+/*
+** jispyc: ahead-of-time compiler from Jispy source to C
+**
+** Parses a .jspy file with the REPL grammar, folds constant subexpressions
+** (see opt.c) and lowers every top level form to C which calls the builtins in lval.c
+** directly. The generated file is linked against the runtime (libjispy.a).
+** Builtins the program rebinds with def or = anywhere are instead looked up
+** when run, and calls to them are not folded.
+**
+** Calls which can only fail are reported as warnings (see lval_infer).
+**
+** Usage: jispyc [--no-fold] [--no-fuse] [--no-infer] input.jspy [output.c]
+*/
+
+/* System Libraries */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Included libraries */
+#include "mpc.h"
+#include "lval.h"
+#include "grammar.h"
+#include "opt.h"
+#include "lambda.h"
+#include "iter.h"
+#include "seq.h"
+#include "record.h"
+#include "map.h"
+#include "rel.h"
+#include "sort.h"
+#include "array.h"
+#include "matrix.h"
+#include "str.h"
+#include "text.h"
+#include "re.h"
+#include "bytes.h"
+
+/* Builtins the compiler can call directly, by C name */
+typedef struct {
+    lbuiltin fun;
+    char* name;
+} cbuiltin;
+
+static cbuiltin cbuiltins[] = {
+    { builtin_list, "builtin_list" },
+    { builtin_head, "builtin_head" },
+    { builtin_tail, "builtin_tail" },
+    { builtin_eval, "builtin_eval" },
+    { builtin_join, "builtin_join" },
+    { builtin_len, "builtin_len" },
+    { builtin_init, "builtin_init" },
+    { builtin_add, "builtin_add" },
+    { builtin_sub, "builtin_sub" },
+    { builtin_mul, "builtin_mul" },
+    { builtin_div, "builtin_div" },
+    { builtin_pow, "builtin_pow" },
+    { builtin_lt, "builtin_lt" },
+    { builtin_gt, "builtin_gt" },
+    { builtin_le, "builtin_le" },
+    { builtin_ge, "builtin_ge" },
+    { builtin_eq, "builtin_eq" },
+    { builtin_ne, "builtin_ne" },
+    { builtin_lambda, "builtin_lambda" },
+    { builtin_def, "builtin_def" },
+    { builtin_put, "builtin_put" },
+    { builtin_map, "builtin_map" },
+    { builtin_filter, "builtin_filter" },
+    { builtin_fold, "builtin_fold" },
+    { builtin_each, "builtin_each" },
+    { builtin_take, "builtin_take" },
+    { builtin_pipeline, "builtin_pipeline" },
+    { builtin_folded, "builtin_folded" },
+    { builtin_range, "builtin_range" },
+    { builtin_collect, "builtin_collect" },
+    { builtin_while, "builtin_while" },
+    { builtin_do_times, "builtin_do_times" },
+    { builtin_for_each, "builtin_for_each" },
+    { builtin_record, "builtin_record" },
+    { builtin_hash_map, "builtin_hash_map" },
+    { builtin_hash_set, "builtin_hash_set" },
+    { builtin_insert, "builtin_insert" },
+    { builtin_lookup, "builtin_lookup" },
+    { builtin_contains, "builtin_contains" },
+    { builtin_delete, "builtin_delete" },
+    { builtin_keys, "builtin_keys" },
+    { builtin_vals, "builtin_vals" },
+    { builtin_size, "builtin_size" },
+    { builtin_group_by, "builtin_group_by" },
+    { builtin_count_by, "builtin_count_by" },
+    { builtin_distinct, "builtin_distinct" },
+    { builtin_hash_join, "builtin_hash_join" },
+    { builtin_sort, "builtin_sort" },
+    { builtin_sort_by, "builtin_sort_by" },
+    { builtin_array, "builtin_array" },
+    { builtin_to_list, "builtin_to_list" },
+    { builtin_slice, "builtin_slice" },
+    { builtin_matrix, "builtin_matrix" },
+    { builtin_matmul, "builtin_matmul" },
+    { builtin_transpose, "builtin_transpose" },
+    { builtin_dot, "builtin_dot" },
+    { builtin_shape, "builtin_shape" },
+    { builtin_str_join, "builtin_str_join" },
+    { builtin_substr, "builtin_substr" },
+    { builtin_str_len, "builtin_str_len" },
+    { builtin_split, "builtin_split" },
+    { builtin_find, "builtin_find" },
+    { builtin_count, "builtin_count" },
+    { builtin_replace, "builtin_replace" },
+    { builtin_re_match, "builtin_re_match" },
+    { builtin_re_find_all, "builtin_re_find_all" },
+    { builtin_re_replace, "builtin_re_replace" },
+    { builtin_re_stats, "builtin_re_stats" },
+    { builtin_mmap_file, "builtin_mmap_file" },
+    { builtin_bytes, "builtin_bytes" },
+    { builtin_bytes_len, "builtin_bytes_len" },
+    { builtin_bytes_ref, "builtin_bytes_ref" },
+    { builtin_bytes_slice, "builtin_bytes_slice" },
+    { builtin_bytes_str, "builtin_bytes_str" },
+    { builtin_bytes_count, "builtin_bytes_count" },
+};
+
+static cbuiltin* cbuiltin_find(lbuiltin f) {
+    for (int i = 0; i < sizeof(cbuiltins) / sizeof(cbuiltin); i++) {
+        if (cbuiltins[i].fun == f) { return &cbuiltins[i]; }
+    }
+    return NULL;
+}
+
+/* Set when the program may rebind names the compiler cannot see */
+static int crebinds_unknown = 0;
+
+/* Resolve symbol k against the compile time environment */
+static cbuiltin* cbuiltin_resolve(lenv* e, lval* k) {
+    if (k->type != LVAL_SYM || crebinds_unknown) { return NULL; }
+    lval* v = lenv_get(e, k);
+    cbuiltin* b = v->type == LVAL_FUN ? cbuiltin_find(v->fun) : NULL;
+    lval_del(v);
+    return b;
+}
+
+static int crebinds_binder(lval* v) {
+    return v->type == LVAL_SYM && (strcmp(v->sym, "def") == 0 || strcmp(v->sym, "=") == 0);
+}
+
+/*
+** The compile time environment never runs def or =, so a builtin the
+** program rebinds anywhere, even in a lambda body, must not be resolved or
+** folded statically. Each name bound by a def or = in prog is unbound here
+** (bound to a placeholder that is not a function), leaving it to be looked
+** up when run. Returns 0 if the names bound cannot all be read from the
+** source: a def whose names are computed, or def itself passed as a value.
+*/
+static int crebinds_hide(lenv* e, lval* prog) {
+
+    int cap = 64, n = 0, known = 1;
+    lval** stack = malloc(sizeof(lval*) * cap);
+    stack[n++] = prog;
+
+    while (n && known) {
+        lval* v = stack[--n];
+        if (v->type != LVAL_SEXPR && v->type != LVAL_QEXPR) { continue; }
+
+        if (v->count > 0 && crebinds_binder(v->cell[0])) {
+            lval* names = v->count > 1 ? v->cell[1] : NULL;
+            known = names && names->type == LVAL_QEXPR;
+            for (int i = 0; known && i < names->count; i++) {
+                known = names->cell[i]->type == LVAL_SYM;
+                if (known) {
+                    lval* hole = lval_sexpr();
+                    lenv_put(e, names->cell[i], hole);
+                    lval_del(hole);
+                }
+            }
+        }
+
+        if (n + v->count > cap) {
+            cap = (n + v->count) * 2;
+            stack = realloc(stack, sizeof(lval*) * cap);
+        }
+        for (int i = 0; i < v->count; i++) {
+            if (i > 0 && crebinds_binder(v->cell[i])) { known = 0; }
+            stack[n++] = v->cell[i];
+        }
+    }
+
+    free(stack);
+    return known;
+}
+
+/*
+** Emitters
+*/
+static void emit_string(FILE* out, char* s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') { fputc('\\', out); }
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+/* C literal of n bytes, any of which may be unprintable or NUL */
+static void emit_bytes(FILE* out, const char* s, long n) {
+    fputc('"', out);
+    for (long i = 0; i < n; i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < ' ' || c > '~') {
+            fprintf(out, "\\%03o", c); // Always three digits, so a digit after it can't join it
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void emit_num(FILE* out, float x) {
+    if (isnan(x)) { fputs("lval_num(NAN)", out); return; }
+    if (isinf(x)) { fprintf(out, "lval_num(%sINFINITY)", x < 0 ? "-" : ""); return; }
+    fprintf(out, "lval_num(%a)", (double)x); // Hex float is exact
+}
+
+/* Emit code constructing v as data (no evaluation) */
+static void emit_value(FILE* out, lval* v) {
+
+    switch(v->type) {
+        case LVAL_NUM:
+            emit_num(out, v->value);
+            break;
+        case LVAL_SYM:
+            fputs("lval_sym(", out);
+            emit_string(out, v->sym);
+            fputc(')', out);
+            break;
+        case LVAL_ERROR:
+            fputs("lval_error(", out);
+            emit_string(out, v->err);
+            fputc(')', out);
+            break;
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            for (int i = 0; i < v->count; i++) { fputs("lval_add(", out); }
+            fputs(v->type == LVAL_QEXPR ? "lval_qexpr()" : "lval_sexpr()", out);
+            for (int i = 0; i < v->count; i++) {
+                fputs(", ", out);
+                emit_value(out, v->cell[i]);
+                fputc(')', out);
+            }
+            break;
+        case LVAL_ARR:
+            fputs("lval_array_of((double[]){ ", out);
+            for (int i = 0; i < v->count; i++) { fprintf(out, "%a, ", v->data[i]); }
+            fprintf(out, "0 }, %d)", v->count);
+            break;
+        case LVAL_MAT:
+            fprintf(out, "lval_matrix_of(%d, %d, (double[]){ ", v->rows, v->cols);
+            for (int i = 0; i < v->count; i++) { fprintf(out, "%a, ", v->data[i]); }
+            fputs("0 })", out);
+            break;
+        case LVAL_STR:
+            fputs("lval_str(", out);
+            emit_bytes(out, lval_str_bytes(v), v->count);
+            fprintf(out, ", %d)", v->count);
+            break;
+        case LVAL_FUN: {
+            cbuiltin* b = cbuiltin_find(v->fun);
+            fprintf(out, "lval_fun(%s)", b ? b->name : "NULL");
+            break;
+        }
+    }
+}
+
+/* Emit code evaluating v */
+static void emit_expr(FILE* out, lenv* e, lval* v) {
+
+    if (v->type == LVAL_SYM) {
+        cbuiltin* b = cbuiltin_resolve(e, v);
+        if (b) {
+            fprintf(out, "lval_fun(%s)", b->name);
+        } else {
+            // Not known at compile time; look it up when run
+            fputs("lval_eval(e, lval_sym(", out);
+            emit_string(out, v->sym);
+            fputs("))", out);
+        }
+        return;
+    }
+
+    if (v->type != LVAL_SEXPR) {
+        emit_value(out, v);
+        return;
+    }
+
+    if (v->count == 0) {
+        fputs("lval_sexpr()", out);
+        return;
+    }
+
+    if (v->count == 1) {
+        emit_expr(out, e, v->cell[0]);
+        return;
+    }
+
+    // Known builtin in head position: call it directly on the arguments
+    cbuiltin* b = cbuiltin_resolve(e, v->cell[0]);
+    int first = b ? 1 : 0;
+
+    if (b) {
+        fprintf(out, "lval_call(e, %s, ", b->name);
+    } else {
+        fputs("eval_sexpression(e, ", out);
+    }
+
+    for (int i = first; i < v->count; i++) { fputs("lval_add(", out); }
+    fputs("lval_sexpr()", out);
+    for (int i = first; i < v->count; i++) {
+        fputs(",\n        ", out);
+        emit_expr(out, e, v->cell[i]);
+        fputc(')', out);
+    }
+    fputc(')', out);
+}
+
+static void emit_program(FILE* out, lenv* e, lval* prog, char* source) {
+
+    fprintf(out, "/* Generated by jispyc from %s. Do not edit. */\n", source);
+    fputs("#include <math.h>\n#include \"lval.h\"\n#include \"lambda.h\"\n#include \"iter.h\"\n#include \"seq.h\"\n#include \"record.h\"\n#include \"map.h\"\n#include \"rel.h\"\n#include \"sort.h\"\n#include \"array.h\"\n#include \"matrix.h\"\n#include \"str.h\"\n#include \"text.h\"\n#include \"re.h\"\n#include \"bytes.h\"\n#include \"opt.h\"\n\n", out);
+
+    for (int i = 0; i < prog->count; i++) {
+        fprintf(out, "static lval* jispy_form_%d(lenv* e) {\n    return ", i);
+        emit_expr(out, e, prog->cell[i]);
+        fputs(";\n}\n\n", out);
+    }
+
+    fputs("int main(int argc, char** argv) {\n", out);
+    fputs("    lenv* e = lenv_new();\n    lenv_add_builtins(e);\n", out);
+    fputs("    lval* x;\n", out);
+    for (int i = 0; i < prog->count; i++) {
+        fprintf(out, "    x = jispy_form_%d(e); lval_println(x); lval_del(x);\n", i);
+    }
+    fputs("    lenv_del(e);\n    return 0;\n}\n", out);
+}
+
+int main(int argc, char** argv) {
+
+    while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+        if (strcmp(argv[1], "--no-fold") == 0) {
+            lval_fold_enabled = 0;
+        } else if (strcmp(argv[1], "--no-fuse") == 0) {
+            lval_fuse_enabled = 0;
+        } else if (strcmp(argv[1], "--no-infer") == 0) {
+            lval_infer_enabled = 0;
+        } else {
+            break;
+        }
+        argv++; argc--;
+    }
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s [--no-fold] [--no-fuse] [--no-infer] input.jspy [output.c]\n", argv[0]);
+        return 1;
+    }
+
+    mpc_parser_t* Lisps = grammar_new();
+
+    mpc_result_t r;
+    if (!mpc_parse_contents(argv[1], Lisps, &r)) {
+        mpc_err_print_to(r.error, stderr);
+        mpc_err_delete(r.error);
+        grammar_cleanup();
+        return 1;
+    }
+
+    FILE* out = argc == 3 ? fopen(argv[2], "w") : stdout;
+    if (!out) {
+        perror(argv[2]);
+        mpc_ast_delete(r.output);
+        grammar_cleanup();
+        return 1;
+    }
+
+    lenv* e = lenv_new();
+    lenv_add_builtins(e);
+
+    // Each top level form is compiled as a separate statement
+    lval* prog = lval_resolve(lval_read(r.output));
+
+    // With no way to tell what is rebound, every name is looked up when run
+    if (!crebinds_hide(e, prog)) {
+        crebinds_unknown = 1;
+        lval_fold_enabled = 0;
+        lval_fuse_enabled = 0;
+        lval_infer_enabled = 0;
+    }
+    for (int i = 0; i < prog->count; i++) {
+        prog->cell[i] = lval_fuse(e, lval_fold(e, prog->cell[i]));
+
+        // Report calls which can only fail; they still run as written
+        lval* errs = lval_qexpr();
+        lval_infer(e, prog->cell[i], errs);
+        for (int j = 0; j < errs->count; j++) {
+            fprintf(stderr, "%s: form %d: warning: %s\n", argv[1], i + 1, errs->cell[j]->err);
+        }
+        lval_del(errs);
+    }
+
+    emit_program(out, e, prog, argv[1]);
+
+    if (out != stdout) { fclose(out); }
+    lval_del(prog);
+    lenv_del(e);
+    mpc_ast_delete(r.output);
+    grammar_cleanup();
+
+    return 0;
+}
@@ -0,0 +1,285 @@
+#include "lambda.h"
+#include "hcons.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define LVAL_ASSERT(args, cond, err)                \
+    if (!(cond)) { lval_del(args); return lval_error(err); }
+
+static int lproto_next_id = 1;
+
+void lproto_release(lproto* p) {
+
+    if (--p->refs > 0) { return; }
+
+    for (int i = 0; i < p->nparams + p->ncaptured; i++) {
+        free(p->names[i]);
+    }
+    free(p->names);
+    free(p->sources);
+    lval_del(p->formals);
+    lval_del(p->body);
+    free(p);
+}
+
+/* Position of name among the locals of p, or -1 */
+static int lproto_find(lproto* p, char* name) {
+    for (int i = 0; i < p->nparams + p->ncaptured; i++) {
+        if (strcmp(p->names[i], name) == 0) { return i; }
+    }
+    return -1;
+}
+
+static int lproto_add_local(lproto* p, char* name) {
+    int n = p->nparams + p->ncaptured;
+    p->names = realloc(p->names, sizeof(char*) * (n + 1));
+    p->names[n] = malloc(strlen(name) + 1);
+    strcpy(p->names[n], name);
+    return n;
+}
+
+/* Capture local source of the frame creating p; returns its local index */
+static int lproto_add_capture(lproto* p, char* name, int source) {
+    int k = lproto_add_local(p, name);
+    p->sources = realloc(p->sources, sizeof(int) * (p->ncaptured + 1));
+    p->sources[p->ncaptured++] = source;
+    return k;
+}
+
+lval* lenv_local(lenv* e, int k) {
+
+    lproto* p = e->proto;
+    if (k < p->nparams) { return e->locals[e->fp + k]; }
+
+    // The closure being called sits just after the parameters
+    return e->locals[e->fp + p->nparams]->env[k - p->nparams];
+}
+
+/*
+** Rewrite every symbol of t naming a local of p to its frame position
+** Q-Expressions are included since they may be evaluated as code in the
+** body (e.g. with eval or as the body of a nested lambda). t is consumed.
+**
+** A call whose head, or the head of a call inside it, becomes a local no
+** longer calls what lval_infer saw, so its check is dropped and *rebound
+** is set.
+*/
+static lval* lambda_compile(lenv* e, lproto* p, lval* t, int* rebound) {
+
+    if (t->type == LVAL_SYM) {
+        int k = lproto_find(p, t->sym);
+
+        // Locals of the creating frame become captured variables
+        if (k < 0 && e->proto) {
+            int source = lproto_find(e->proto, t->sym);
+            if (source >= 0) { k = lproto_add_capture(p, t->sym, source); }
+        }
+        if (k < 0) { return t; }
+
+        lval* s = lval_sym(t->sym);
+        s->slot = t->slot;
+        s->local = k;
+        s->fn = p->id;
+        lval_del(t);
+        return s;
+    }
+
+    if (t->type != LVAL_QEXPR && t->type != LVAL_SEXPR) { return t; }
+
+    // Rewrite a private copy; unchanged subtrees are shared again by lval_hcons
+    t = lval_own(t);
+    int changed = 0;
+    for (int i = 0; i < t->count; i++) {
+        t->cell[i] = lambda_compile(e, p, t->cell[i], &changed);
+    }
+    if (t->count && t->cell[0]->type == LVAL_SYM && t->cell[0]->fn) { changed = 1; }
+    if (changed) {
+        t->checked = NULL;
+        *rebound = 1;
+    }
+    return lval_hcons(t);
+}
+
+lval* lval_lambda(lenv* e, lval* formals, lval* body) {
+
+    lproto* p = calloc(1, sizeof(lproto));
+    p->refs = 1;
+    p->id = lproto_next_id++;
+
+    for (int i = 0; i < formals->count; i++) {
+        if (strcmp(formals->cell[i]->sym, "&") == 0) {
+            p->variadic = 1;
+            continue;
+        }
+        lproto_add_local(p, formals->cell[i]->sym);
+        p->nparams++;
+    }
+
+    p->formals = formals;
+    int rebound = 0;
+    p->body = lambda_compile(e, p, body, &rebound);
+
+    lval* f = lval_fun(NULL);
+    f->proto = p;
+
+    // Flat closure: copy the value of each captured variable now
+    f->env = malloc(sizeof(lval*) * p->ncaptured);
+    for (int j = 0; j < p->ncaptured; j++) {
+        f->env[j] = lval_copy(lenv_local(e, p->sources[j]));
+    }
+
+    return f;
+}
+
+lval* lambda_enter(lenv* e, lval* f, lval* a) {
+
+    lproto* p = f->proto;
+    int fixed = p->variadic ? p->nparams - 1 : p->nparams;
+
+    if (a->count < fixed || (!p->variadic && a->count > fixed)) {
+        lval_del(f); lval_del(a);
+        return lval_error("Function passed wrong number of arguments");
+    }
+
+    if (e->nlocals + p->nparams + 1 > e->locals_size) {
+        e->locals_size = 2 * (e->nlocals + p->nparams + 1);
+        e->locals = realloc(e->locals, sizeof(lval*) * e->locals_size);
+    }
+
+    // Move the arguments straight into the frame
+    int fp = e->nlocals;
+    for (int i = 0; i < fixed; i++) {
+        e->locals[e->nlocals++] = a->cell[i];
+    }
+
+    if (p->variadic) {
+        lval* rest = lval_qexpr();
+        for (int i = fixed; i < a->count; i++) {
+            lval_add(rest, a->cell[i]);
+        }
+        e->locals[e->nlocals++] = rest;
+    }
+
+    a->count = 0;
+    lval_del(a);
+
+    e->locals[e->nlocals++] = f;
+    e->fp = fp;
+    e->proto = p;
+
+    lval* x = lval_own(lval_copy(p->body));
+    x->type = LVAL_SEXPR;
+    return x;
+}
+
+void lambda_leave(lenv* e, int fp, lproto* proto) {
+
+    while (e->nlocals > e->fp) {
+        lval_del(e->locals[--e->nlocals]);
+    }
+
+    e->fp = fp;
+    e->proto = proto;
+}
+
+void lambda_reuse(lenv* e, int fp) {
+
+    for (int i = fp; i < e->fp; i++) {
+        lval_del(e->locals[i]);
+    }
+
+    int n = e->nlocals - e->fp;
+    memmove(&e->locals[fp], &e->locals[e->fp], sizeof(lval*) * n);
+    e->nlocals = fp + n;
+    e->fp = fp;
+}
+
+/*
+** Builtins
+*/
+
+/* Create a function: \ {formals} {body} */
+lval* builtin_lambda(lenv* e, lval* a) {
+
+    LVAL_ASSERT(a, a->count == 2, "Function '\\' passed wrong number of arguments");
+    LVAL_ASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function '\\' formals not a Q-Expression");
+    LVAL_ASSERT(a, a->cell[1]->type == LVAL_QEXPR, "Function '\\' body not a Q-Expression");
+
+    lval* formals = a->cell[0];
+    for (int i = 0; i < formals->count; i++) {
+        LVAL_ASSERT(a, formals->cell[i]->type == LVAL_SYM, "Function '\\' cannot define non-symbol");
+        if (strcmp(formals->cell[i]->sym, "&") == 0) {
+            LVAL_ASSERT(a, i == formals->count - 2, "Function '\\' '&' not followed by a single symbol");
+        }
+    }
+
+    formals = lval_pop(a, 0);
+    lval* body = lval_take(a, 0);
+    return lval_lambda(e, formals, body);
+}
+
+/* Check the arguments of def and = */
+static lval* lval_check_binding(lval* a) {
+
+    if (a->count == 0 || a->cell[0]->type != LVAL_QEXPR) {
+        return lval_error("Binding passed incorrect type");
+    }
+
+    lval* syms = a->cell[0];
+    for (int i = 0; i < syms->count; i++) {
+        if (syms->cell[i]->type != LVAL_SYM) {
+            return lval_error("Binding cannot define non-symbol");
+        }
+    }
+
+    if (syms->count != a->count - 1) {
+        return lval_error("Binding passed wrong number of values");
+    }
+
+    return NULL;
+}
+
+/* Bind symbols in the global environment: def {x y} 1 2 */
+lval* builtin_def(lenv* e, lval* a) {
+
+    lval* err = lval_check_binding(a);
+    if (err) { lval_del(a); return err; }
+
+    lval* syms = a->cell[0];
+    for (int i = 0; i < syms->count; i++) {
+        lenv_put(e, syms->cell[i], a->cell[i+1]);
+    }
+
+    lval_del(a);
+    return lval_sexpr();
+}
+
+void lenv_assign(lenv* e, lval* k, lval* v) {
+
+    int i = e->proto ? lproto_find(e->proto, k->sym) : -1;
+    if (i < 0) {
+        lenv_put(e, k, v);
+        return;
+    }
+
+    lval** slot = i < e->proto->nparams
+        ? &e->locals[e->fp + i]
+        : &e->locals[e->fp + e->proto->nparams]->env[i - e->proto->nparams];
+    lval_del(*slot);
+    *slot = lval_copy(v);
+}
+
+/* Assign locals of the current call, or globals outside one: = {x} 1 */
+lval* builtin_put(lenv* e, lval* a) {
+
+    lval* err = lval_check_binding(a);
+    if (err) { lval_del(a); return err; }
+
+    lval* syms = a->cell[0];
+    for (int i = 0; i < syms->count; i++) {
+        lenv_assign(e, syms->cell[i], a->cell[i+1]);
+    }
+
+    lval_del(a);
+    return lval_sexpr();
+}
@@ -0,0 +1,53 @@
+#ifndef LAMBDA_H_
+#define LAMBDA_H_
+
+#include "lval.h"
+
+/*
+** User defined functions
+**
+** A lambda is compiled once when it is created. Symbols naming a parameter
+** or a captured variable are rewritten to a position in the call frame
+** (lval->local), and the values of captured variables are copied into the
+** closure itself (lval->env), so a closure holds only its free variables.
+**
+** A call frame is a run of slots on the environment's local stack: the
+** arguments in parameter order followed by the closure being called.
+** Calling a function never allocates an environment.
+*/
+struct lproto {
+    int refs;
+    int id;         // Identifies frames of this function in lval->fn
+    int nparams;    // Including the rest parameter of a variadic function
+    int variadic;   // Last parameter collects the remaining arguments
+    int ncaptured;
+    char** names;   // Parameter names followed by captured names
+    int* sources;   // Frame position each captured value is copied from
+    lval* formals;  // Parameter list as written
+    lval* body;     // Compiled body (Q-Expression)
+};
+
+lval* lval_lambda(lenv* e, lval* formals, lval* body);
+void lproto_release(lproto* p);
+
+/* Value of local k in the current call frame (borrowed) */
+lval* lenv_local(lenv* e, int k);
+
+/* Bind arguments a to closure f in a new call frame and return its body */
+lval* lambda_enter(lenv* e, lval* f, lval* a);
+
+/* Release the current call frame; fp becomes the current frame again */
+void lambda_leave(lenv* e, int fp, lproto* proto);
+
+/* Move the current call frame down over the frame starting at fp */
+void lambda_reuse(lenv* e, int fp);
+
+/* Set k to a copy of v: a local of the current call if it names one, else a global */
+void lenv_assign(lenv* e, lval* k, lval* v);
+
+/* Builtins */
+lval* builtin_lambda(lenv* e, lval* a);
+lval* builtin_def(lenv* e, lval* a);
+lval* builtin_put(lenv* e, lval* a);
+
+#endif // LAMBDA_H_
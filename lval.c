@@ -1,4 +1,20 @@
 #include "lval.h"
+#include "hcons.h"
+#include "memo.h"
+#include "lambda.h"
+#include "iter.h"
+#include "seq.h"
+#include "record.h"
+#include "map.h"
+#include "rel.h"
+#include "sort.h"
+#include "array.h"
+#include "vec.h"
+#include "matrix.h"
+#include "str.h"
+#include "text.h"
+#include "re.h"
+#include "bytes.h"
 #include "mpc.h"
 #include <errno.h>
 #include <stdio.h>
@@ -8,26 +24,93 @@
 #define LVAL_ASSERT(args, cond, err)                \
     if (!(cond)) { lval_del(args); return lval_error(err); }
 
+/*
+** Work stack
+**
+** The tree walkers below are iterative and keep their pending work on this
+** growable heap stack, so nesting depth is limited by memory rather than by
+** the C stack.
+*/
+typedef struct {
+    lval* v;  // Node being walked
+    lval* w;  // Node being built (copy) or parent result
+    void* p;  // Foreign node (mpc_ast_t while reading, lproto while evaluating)
+    int i;    // Next child to visit
+    int fp;   // Call frame the node is evaluated in
+    int lent; // Children are borrowed from code evaluated again (see lval_eval_code)
+} lwork;
+
+#define LSTACK_LOCAL 32
+
+/* Shallow walks stay within the local items and never touch the heap */
+typedef struct {
+    int count;
+    int size;
+    lwork* items;
+    lwork local[LSTACK_LOCAL];
+} lstack;
+
+static void lstack_init(lstack* s) {
+    s->count = 0;
+    s->size = LSTACK_LOCAL;
+    s->items = s->local;
+}
+
+static lwork* lstack_push(lstack* s, lval* v, lval* w, void* p) {
+    if (s->count == s->size) {
+        s->size *= 2;
+        if (s->items == s->local) {
+            s->items = malloc(sizeof(lwork) * s->size);
+            memcpy(s->items, s->local, sizeof(s->local));
+        } else {
+            s->items = realloc(s->items, sizeof(lwork) * s->size);
+        }
+    }
+    lwork* x = &s->items[s->count++];
+    x->v = v;
+    x->w = w;
+    x->p = p;
+    x->i = 0;
+    x->lent = 0;
+    return x;
+}
+
+static int lval_is_expr(lval* v) {
+    return v->type == LVAL_QEXPR || v->type == LVAL_SEXPR || v->type == LVAL_REC;
+}
+
+static lwork* lstack_top(lstack* s) {
+    return s->count ? &s->items[s->count-1] : NULL;
+}
+
+static void lstack_free(lstack* s) {
+    if (s->items != s->local) { free(s->items); }
+}
+
 /*
 ** "Constructors"
 */
 lenv* lenv_new() {
     lenv* e = malloc(sizeof(lenv));
     e->count = 0;
-    e->syms = NULL;
     e->vals = NULL;
+    e->locals = NULL;
+    e->nlocals = 0;
+    e->locals_size = 0;
+    e->fp = 0;
+    e->proto = NULL;
     return e;
 }
 
 lval* lval_num(float num) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = calloc(1, sizeof(lval));
     v->type = LVAL_NUM;
     v->value = num;
     return v;
 }
 
 lval* lval_error(char* err) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = calloc(1, sizeof(lval));
     v->type = LVAL_ERROR;
     v->err = malloc(strlen(err)+1); // Allocate size of string first
     strcpy(v->err, err); // Then copy
@@ -35,15 +118,16 @@ lval* lval_error(char* err) {
 }
 
 lval* lval_sym(char* s) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = calloc(1, sizeof(lval));
     v->type = LVAL_SYM;
-    v->sym = malloc(sizeof(s)+1);
+    v->sym = malloc(strlen(s)+1);
     strcpy(v->sym, s);
+    v->slot = -1;
     return v;
 }
 
 lval* lval_sexpr(void) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = calloc(1, sizeof(lval));
     v->type = LVAL_SEXPR;
     v->count = 0;
     v->cell = NULL;
@@ -51,7 +135,7 @@ lval* lval_sexpr(void) {
 }
 
 lval* lval_qexpr(void) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = calloc(1, sizeof(lval));
     v->type = LVAL_QEXPR;
     v->count = 0;
     v->cell = NULL;
@@ -59,7 +143,7 @@ lval* lval_qexpr(void) {
 }
 
 lval* lval_fun(lbuiltin f) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = calloc(1, sizeof(lval));
     v->type = LVAL_FUN;
     v->fun = f;
     return v;
@@ -69,51 +153,182 @@ lval* lval_fun(lbuiltin f) {
 ** Destructor
 */
 void lenv_del(lenv* e) {
-    /* For each element in syms and vals array; delete */
+    /* For each bound slot; delete its value */
     for (int i = 0; i < e->count; i++) {
-        free(e->syms[i]);
-        lval_del(e->vals[i]);
+        if (e->vals[i]) { lval_del(e->vals[i]); }
     }
-    free(e->syms);
     free(e->vals);
+    free(e->locals);
     free(e);
 }
 
-void lval_del(lval* v) {
-  switch (v->type) {
-    /* Do nothing special for number type */
-    case LVAL_NUM: break;
+/* Drop one reference to v; returns 1 if v must now be freed */
+static int lval_release(lval* v) {
+
+  /* Shared nodes are freed by their last owner */
+  if (v->refs > 0) {
+    if (--v->refs > 0) { return 0; }
+    lval_hcons_remove(v);
+  }
+  return 1;
+}
+
+/* Free a value which has no children */
+static void lval_free_atom(lval* v) {
 
+  switch (v->type) {
     /* For Err or Sym free the string data */
     case LVAL_ERROR: free(v->err); break;
     case LVAL_SYM: free(v->sym); break;
 
-    /* If S-expression or Q-expression then delete all elements inside */
-    case LVAL_QEXPR:
-    case LVAL_SEXPR:
-      for (int i = 0; i < v->count; i++) {
-        lval_del(v->cell[i]);
+    case LVAL_FUN:
+      if (v->memo) { lmemo_release(v->memo); }
+      if (v->rec) { lrec_release(v->rec); }
+      if (v->proto) {
+        for (int i = 0; i < v->proto->ncaptured; i++) { lval_del(v->env[i]); }
+        free(v->env);
+        lproto_release(v->proto);
       }
-      /* Also free the memory allocated to contain the pointers */
-      free(v->cell);
       break;
 
-    case LVAL_FUN: break;
+    case LVAL_SEQ: lseq_release(v->seq); break;
+
+    case LVAL_MAP:
+    case LVAL_SET: lmap_release(v->map); break;
+
+    case LVAL_ARR:
+    case LVAL_MAT:
+    case LVAL_BYTES: lbuf_release(v->buf); break;
 
+    case LVAL_STR: if (v->str) { lstr_release(v->str); } break;
   }
 
   /* Free the memory allocated for the "lval" struct itself */
   free(v);
 }
 
+void lval_del(lval* v) {
+
+  if (!lval_release(v)) { return; }
+  if (!lval_is_expr(v)) { lval_free_atom(v); return; }
+
+  /* If S-expression or Q-expression then delete all elements inside */
+  lstack s;
+  lstack_init(&s);
+  lstack_push(&s, v, NULL, NULL);
+
+  while (s.count) {
+    lwork* top = lstack_top(&s);
+
+    if (top->i < top->v->count) {
+      lval* c = top->v->cell[top->i++];
+      if (!lval_release(c)) { continue; }
+      if (lval_is_expr(c)) {
+        lstack_push(&s, c, NULL, NULL);
+      } else {
+        lval_free_atom(c);
+      }
+      continue;
+    }
+
+    /* Also free the memory allocated to contain the pointers */
+    if (top->v->type == LVAL_REC) { lrec_release(top->v->rec); }
+    free(top->v->cell);
+    free(top->v);
+    s.count--;
+  }
+
+  lstack_free(&s);
+}
+
+/*
+** Symbol slots
+**
+** Every symbol name is given a stable slot index the first time it is seen.
+** Environments store values by slot, so a resolved symbol is looked up with
+** a single indexed load instead of a search by name.
+*/
+static char** slot_names = NULL;
+static int slot_count = 0;
+
+/* Open addressing index from name to slot (-1 when empty) */
+static int* slot_index = NULL;
+static int slot_index_size = 0;
+
+static unsigned long lsym_hash(char* s) {
+    unsigned long h = 14695981039346656037UL;
+    for (; *s; s++) { h = (h ^ (unsigned char)*s) * 1099511628211UL; }
+    return h;
+}
+
+static void lsym_index_grow(void) {
+
+    free(slot_index);
+    slot_index_size = slot_index_size ? slot_index_size * 2 : 256;
+    slot_index = malloc(sizeof(int) * slot_index_size);
+    for (int i = 0; i < slot_index_size; i++) { slot_index[i] = -1; }
+
+    for (int i = 0; i < slot_count; i++) {
+        unsigned long j = lsym_hash(slot_names[i]) & (slot_index_size - 1);
+        while (slot_index[j] >= 0) { j = (j + 1) & (slot_index_size - 1); }
+        slot_index[j] = i;
+    }
+}
+
+int lsym_slot(char* name) {
+
+    if (2 * (slot_count + 1) > slot_index_size) { lsym_index_grow(); }
+
+    unsigned long j = lsym_hash(name) & (slot_index_size - 1);
+    while (slot_index[j] >= 0) {
+        if (strcmp(slot_names[slot_index[j]], name) == 0) { return slot_index[j]; }
+        j = (j + 1) & (slot_index_size - 1);
+    }
+
+    /* First time this name is seen; give it the next slot */
+    slot_names = realloc(slot_names, sizeof(char*) * (slot_count + 1));
+    slot_names[slot_count] = malloc(strlen(name) + 1);
+    strcpy(slot_names[slot_count], name);
+    slot_index[j] = slot_count;
+    return slot_count++;
+}
+
+char* lsym_name(int slot) {
+    return slot_names[slot];
+}
+
+/* Resolve every symbol in t to its slot; run once when a form is read */
+lval* lval_resolve(lval* t) {
+
+    lstack s;
+    lstack_init(&s);
+    lstack_push(&s, t, NULL, NULL);
+
+    while (s.count) {
+        lval* v = s.items[--s.count].v;
+        if (v->type == LVAL_SYM && v->slot < 0) { v->slot = lsym_slot(v->sym); }
+        if (lval_is_expr(v)) {
+            for (int i = 0; i < v->count; i++) { lstack_push(&s, v->cell[i], NULL, NULL); }
+        }
+    }
+
+    lstack_free(&s);
+    return t;
+}
+
 /* Environment methods */
 lval* lenv_get(lenv* e, lval* k) {
 
-    /* Iterate through all environment symbols and return */
-    for(int i = 0; i < e->count; i++) {
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            return e->vals[i];
-        }
+    /* Locals of the current call are found by position */
+    if (k->fn && e->proto && k->fn == e->proto->id) {
+        return lval_copy(lenv_local(e, k->local));
+    }
+
+    /* Symbols which were not resolved when read are looked up by name */
+    int slot = k->slot >= 0 ? k->slot : lsym_slot(k->sym);
+
+    if (slot < e->count && e->vals[slot]) {
+        return lval_copy(e->vals[slot]);
     }
 
     return lval_error("unbound symbol");
@@ -121,54 +336,222 @@ lval* lenv_get(lenv* e, lval* k) {
 
 void lenv_put(lenv* e, lval* k, lval* v) {
 
-    /* Ensure variable hasn't already been assigned */
-    /* Else copy variable assigned by user */
-    for(int i = 0; i < e->count; i++) {
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-            return;
-        }
+    int slot = k->slot >= 0 ? k->slot : lsym_slot(k->sym);
+
+    /* Reallocate space for slots not captured already */
+    if (slot >= e->count) {
+        e->vals = realloc(e->vals, sizeof(lval*) * (slot + 1));
+        memset(&e->vals[e->count], 0, sizeof(lval*) * (slot + 1 - e->count));
+        e->count = slot + 1;
     }
 
-    /* Reallocate space for variable not captured already */
-    e->count++;
-    e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
+    /* Calls checked against a typed builtin no longer hold once it is replaced */
+    lval* old = e->vals[slot];
+    if (old && old->type == LVAL_FUN && old->sig && old->sig != v->sig) {
+        lsig_marks_valid = 0;
+    }
 
-    /* Copy variable into the new space */
-    e->vals[e->count-1] = lval_copy(v);
-    e->syms[e->count-1] = malloc(strlen(k->sym) + 1);
-    strcpy(e->syms[e->count-1], k->sym);
+    /* Update the cell in place so resolved symbols see the new value */
+    if (e->vals[slot]) { lval_del(e->vals[slot]); }
+    e->vals[slot] = lval_copy(v);
 }
 
-void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
+void lenv_add_builtin(lenv* e, char* name, lbuiltin func, const lsig* sig) {
 
     lval* k = lval_sym(name);
     lval* v = lval_fun(func);
+    v->sig = sig;
     lenv_put(e, k, v);
     lval_del(k);
     lval_del(v);
 
 }
 
+/*
+** Registry of pure builtins
+**
+** A pure builtin has no side effects and its result depends only on its
+** arguments, so calls with constant arguments may be evaluated ahead of time.
+*/
+#define LBUILTIN_PURE_MAX 64
+
+static lbuiltin pure_builtins[LBUILTIN_PURE_MAX];
+static int pure_count = 0;
+
+void lbuiltin_mark_pure(lbuiltin f) {
+    if (lbuiltin_is_pure(f) || pure_count == LBUILTIN_PURE_MAX) { return; }
+    pure_builtins[pure_count++] = f;
+}
+
+int lbuiltin_is_pure(lbuiltin f) {
+    for (int i = 0; i < pure_count; i++) {
+        if (pure_builtins[i] == f) { return 1; }
+    }
+    return 0;
+}
+
+/* Signatures of the typed builtins, defined with them below */
+static const lsig sig_head, sig_tail, sig_join, sig_len, sig_init;
+static const lsig sig_add, sig_sub, sig_mul, sig_div, sig_pow;
+static const lsig sig_lt, sig_gt, sig_le, sig_ge, sig_eq, sig_ne;
+
 void lenv_add_builtins(lenv *e) {
 
     /* q-expression functions */
-    lenv_add_builtin(e, "list", builtin_list);
-    lenv_add_builtin(e, "head", builtin_head);
-    lenv_add_builtin(e, "tail", builtin_tail);
-    lenv_add_builtin(e, "eval", builtin_eval);
-    lenv_add_builtin(e, "join", builtin_join);
-    lenv_add_builtin(e, "len", builtin_len);
-    lenv_add_builtin(e, "init", builtin_init);
+    lenv_add_builtin(e, "list", builtin_list, NULL);
+    lenv_add_builtin(e, "head", builtin_head, &sig_head);
+    lenv_add_builtin(e, "tail", builtin_tail, &sig_tail);
+    lenv_add_builtin(e, "eval", builtin_eval, NULL);
+    lenv_add_builtin(e, "join", builtin_join, &sig_join);
+    lenv_add_builtin(e, "len", builtin_len, &sig_len);
+    lenv_add_builtin(e, "init", builtin_init, &sig_init);
+
+    /* higher order functions */
+    lenv_add_builtin(e, "map", builtin_map, &sig_map);
+    lenv_add_builtin(e, "filter", builtin_filter, &sig_filter);
+    lenv_add_builtin(e, "fold", builtin_fold, &sig_fold);
+    lenv_add_builtin(e, "each", builtin_each, &sig_each);
+    lenv_add_builtin(e, "take", builtin_take, &sig_take);
+    lenv_add_builtin(e, "pipeline", builtin_pipeline, &sig_pipeline);
+
+    /* lazy sequences */
+    lenv_add_builtin(e, "range", builtin_range, &sig_range);
+    lenv_add_builtin(e, "collect", builtin_collect, &sig_collect);
+
+    /* hash maps and sets */
+    lenv_add_builtin(e, "hash-map", builtin_hash_map, &sig_hash_map);
+    lenv_add_builtin(e, "hash-set", builtin_hash_set, &sig_hash_set);
+    lenv_add_builtin(e, "insert", builtin_insert, &sig_insert);
+    lenv_add_builtin(e, "lookup", builtin_lookup, &sig_lookup);
+    lenv_add_builtin(e, "contains", builtin_contains, &sig_contains);
+    lenv_add_builtin(e, "delete", builtin_delete, &sig_delete);
+    lenv_add_builtin(e, "keys", builtin_keys, &sig_keys);
+    lenv_add_builtin(e, "vals", builtin_vals, &sig_vals);
+    lenv_add_builtin(e, "size", builtin_size, &sig_size);
+
+    /* relational functions */
+    lenv_add_builtin(e, "group-by", builtin_group_by, &sig_group_by);
+    lenv_add_builtin(e, "count-by", builtin_count_by, &sig_count_by);
+    lenv_add_builtin(e, "distinct", builtin_distinct, &sig_distinct);
+    lenv_add_builtin(e, "hash-join", builtin_hash_join, &sig_hash_join);
+
+    /* sorting */
+    lenv_add_builtin(e, "sort", builtin_sort, &sig_sort);
+    lenv_add_builtin(e, "sort-by", builtin_sort_by, &sig_sort_by);
+
+    /* numeric arrays */
+    lenv_add_builtin(e, "array", builtin_array, &sig_array);
+    lenv_add_builtin(e, "to-list", builtin_to_list, &sig_to_list);
+    lenv_add_builtin(e, "slice", builtin_slice, &sig_slice);
+
+    /* matrices */
+    lenv_add_builtin(e, "matrix", builtin_matrix, &sig_matrix);
+    lenv_add_builtin(e, "matmul", builtin_matmul, &sig_matmul);
+    lenv_add_builtin(e, "transpose", builtin_transpose, &sig_transpose);
+    lenv_add_builtin(e, "dot", builtin_dot, &sig_dot);
+    lenv_add_builtin(e, "shape", builtin_shape, &sig_shape);
+
+    /* strings */
+    lenv_add_builtin(e, "str-join", builtin_str_join, &sig_str_join);
+    lenv_add_builtin(e, "substr", builtin_substr, &sig_substr);
+    lenv_add_builtin(e, "str-len", builtin_str_len, &sig_str_len);
+    lenv_add_builtin(e, "split", builtin_split, &sig_split);
+    lenv_add_builtin(e, "find", builtin_find, &sig_find);
+    lenv_add_builtin(e, "count", builtin_count, &sig_count);
+    lenv_add_builtin(e, "replace", builtin_replace, &sig_replace);
+
+    /* regular expressions */
+    lenv_add_builtin(e, "re-match", builtin_re_match, &sig_re_match);
+    lenv_add_builtin(e, "re-find-all", builtin_re_find_all, &sig_re_find_all);
+    lenv_add_builtin(e, "re-replace", builtin_re_replace, &sig_re_replace);
+    lenv_add_builtin(e, "re-stats", builtin_re_stats, &sig_re_stats);
+
+    /* bytevectors */
+    lenv_add_builtin(e, "mmap-file", builtin_mmap_file, &sig_mmap_file);
+    lenv_add_builtin(e, "bytes", builtin_bytes, &sig_bytes);
+    lenv_add_builtin(e, "bytes-len", builtin_bytes_len, &sig_bytes_len);
+    lenv_add_builtin(e, "bytes-ref", builtin_bytes_ref, &sig_bytes_ref);
+    lenv_add_builtin(e, "bytes-slice", builtin_bytes_slice, &sig_bytes_slice);
+    lenv_add_builtin(e, "bytes-str", builtin_bytes_str, &sig_bytes_str);
+    lenv_add_builtin(e, "bytes-count", builtin_bytes_count, &sig_bytes_count);
+
+    /* record types */
+    lenv_add_builtin(e, "record", builtin_record, NULL);
+
+    /* variables and functions */
+    lenv_add_builtin(e, "\\", builtin_lambda, NULL);
+    lenv_add_builtin(e, "def", builtin_def, NULL);
+    lenv_add_builtin(e, "=", builtin_put, NULL);
+
+    /* memoization */
+    lenv_add_builtin(e, "memo", builtin_memo, NULL);
+    lenv_add_builtin(e, "memo-stats", builtin_memo_stats, NULL);
+    lenv_add_builtin(e, "memo-clear", builtin_memo_clear, NULL);
 
     /* mathematically functions */
-    lenv_add_builtin(e, "+", builtin_add);
-    lenv_add_builtin(e, "-", builtin_sub);
-    lenv_add_builtin(e, "*", builtin_mul);
-    lenv_add_builtin(e, "/", builtin_div);
-    lenv_add_builtin(e, "^", builtin_pow);
+    lenv_add_builtin(e, "+", builtin_add, &sig_add);
+    lenv_add_builtin(e, "-", builtin_sub, &sig_sub);
+    lenv_add_builtin(e, "*", builtin_mul, &sig_mul);
+    lenv_add_builtin(e, "/", builtin_div, &sig_div);
+    lenv_add_builtin(e, "^", builtin_pow, &sig_pow);
+
+    /* comparison functions */
+    lenv_add_builtin(e, "<", builtin_lt, &sig_lt);
+    lenv_add_builtin(e, ">", builtin_gt, &sig_gt);
+    lenv_add_builtin(e, "<=", builtin_le, &sig_le);
+    lenv_add_builtin(e, ">=", builtin_ge, &sig_ge);
+    lenv_add_builtin(e, "==", builtin_eq, &sig_eq);
+    lenv_add_builtin(e, "!=", builtin_ne, &sig_ne);
+
+    /* loops */
+    lenv_add_builtin(e, "while", builtin_while, &sig_while);
+    lenv_add_builtin(e, "do-times", builtin_do_times, &sig_do_times);
+    lenv_add_builtin(e, "for-each", builtin_for_each, &sig_for_each);
+
+    /* builtins whose result depends only on their arguments may be folded;
+       not those that run code (eval, map, the loops...), bind names, read
+       files, or update state something can observe (memo, and the regex
+       cache whose counters re-stats reports) */
+    lbuiltin_mark_pure(builtin_list);
+    lbuiltin_mark_pure(builtin_head);
+    lbuiltin_mark_pure(builtin_tail);
+    lbuiltin_mark_pure(builtin_join);
+    lbuiltin_mark_pure(builtin_len);
+    lbuiltin_mark_pure(builtin_init);
+    lbuiltin_mark_pure(builtin_take);
+    lbuiltin_mark_pure(builtin_distinct);
+    lbuiltin_mark_pure(builtin_sort);
+    lbuiltin_mark_pure(builtin_array);
+    lbuiltin_mark_pure(builtin_to_list);
+    lbuiltin_mark_pure(builtin_slice);
+    lbuiltin_mark_pure(builtin_matrix);
+    lbuiltin_mark_pure(builtin_matmul);
+    lbuiltin_mark_pure(builtin_transpose);
+    lbuiltin_mark_pure(builtin_dot);
+    lbuiltin_mark_pure(builtin_shape);
+    lbuiltin_mark_pure(builtin_str_join);
+    lbuiltin_mark_pure(builtin_substr);
+    lbuiltin_mark_pure(builtin_str_len);
+    lbuiltin_mark_pure(builtin_split);
+    lbuiltin_mark_pure(builtin_find);
+    lbuiltin_mark_pure(builtin_count);
+    lbuiltin_mark_pure(builtin_replace);
+    lbuiltin_mark_pure(builtin_bytes_len);
+    lbuiltin_mark_pure(builtin_bytes_ref);
+    lbuiltin_mark_pure(builtin_bytes_slice);
+    lbuiltin_mark_pure(builtin_bytes_str);
+    lbuiltin_mark_pure(builtin_bytes_count);
+    lbuiltin_mark_pure(builtin_add);
+    lbuiltin_mark_pure(builtin_sub);
+    lbuiltin_mark_pure(builtin_mul);
+    lbuiltin_mark_pure(builtin_div);
+    lbuiltin_mark_pure(builtin_pow);
+    lbuiltin_mark_pure(builtin_lt);
+    lbuiltin_mark_pure(builtin_gt);
+    lbuiltin_mark_pure(builtin_le);
+    lbuiltin_mark_pure(builtin_ge);
+    lbuiltin_mark_pure(builtin_eq);
+    lbuiltin_mark_pure(builtin_ne);
 
 }
 
@@ -179,29 +562,65 @@ void lenv_add_builtins(lenv *e) {
 */
 lval* lval_read(mpc_ast_t* t) {
 
-    // If just number or symbol return lval object
-    if (strstr(t->tag, "number")) { return lval_read_num(t); }
-    if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
-
-    // If empty line; create s-expression
+    lstack s;
+    lstack_init(&s);
     lval* x = NULL;
-    if (strcmp(t->tag, ">") == 0) { x = lval_sexpr(); }
-    if (strstr(t->tag, "sexpression")) { x = lval_sexpr(); }
-    if (strstr(t->tag, "qexpression")) { x = lval_qexpr(); }
 
-    // Handle the children of abstract syntax tree type
-    for (int i = 0; i < t->children_num; i++) {
+    while (1) {
+
+        // If just number, symbol or string use its canonical lval object
+        if (strstr(t->tag, "number")) {
+            x = lval_hcons(lval_read_num(t));
+        } else if (strstr(t->tag, "symbol")) {
+            x = lval_hcons(lval_sym(t->contents));
+        } else if (strstr(t->tag, "string")) {
+            x = lval_hcons(lval_read_str(t));
+        } else if (strstr(t->tag, "array")) {
+            x = lval_read_array(t);
+        } else {
+            // If empty line; create s-expression
+            x = NULL;
+            if (strcmp(t->tag, ">") == 0) { x = lval_sexpr(); }
+            if (strstr(t->tag, "sexpression")) { x = lval_sexpr(); }
+            if (strstr(t->tag, "qexpression")) { x = lval_qexpr(); }
+            lstack_push(&s, x, NULL, t);
+            x = NULL;
+        }
 
-        // Handle
-        if (strcmp(t->children[i]->contents, ")") == 0) { continue; }
-        if (strcmp(t->children[i]->contents, "(") == 0) { continue; }
-        if (strcmp(t->children[i]->contents, "{") == 0) { continue; }
-        if (strcmp(t->children[i]->contents, "}") == 0) { continue; }
-        if (strcmp(t->children[i]->tag, "regex") == 0) { continue; }
+        // Add the finished value to its parent and find the next child to read
+        t = NULL;
+        while (s.count) {
+            lwork* top = lstack_top(&s);
+            mpc_ast_t* a = top->p;
+
+            if (x) {
+                top->v = lval_add(top->v, x);
+                x = NULL;
+            }
 
-        x = lval_add(x, lval_read(t->children[i]));
+            // Handle the children of abstract syntax tree type
+            while (top->i < a->children_num) {
+                mpc_ast_t* c = a->children[top->i++];
+                if (strcmp(c->contents, ")") == 0) { continue; }
+                if (strcmp(c->contents, "(") == 0) { continue; }
+                if (strcmp(c->contents, "{") == 0) { continue; }
+                if (strcmp(c->contents, "}") == 0) { continue; }
+                if (strcmp(c->tag, "regex") == 0) { continue; }
+                t = c;
+                break;
+            }
+            if (t) { break; }
+
+            // Q-Expression literals are immutable data and can be shared
+            x = top->v;
+            if (x->type == LVAL_QEXPR) { x = lval_hcons(x); }
+            s.count--;
+        }
+
+        if (!t) { break; }
     }
 
+    lstack_free(&s);
     return x;
 }
 
@@ -214,6 +633,42 @@ lval* lval_read_num(mpc_ast_t* t) {
     return errno != ERANGE ? lval_num(x): lval_error("invalid number");
 }
 
+/*
+** Array literal; its children are the brackets and the numbers
+*/
+lval* lval_read_array(mpc_ast_t* t) {
+
+    lval* x = lval_array(t->children_num - 2);
+    long n = 0;
+    for (int i = 0; i < t->children_num; i++) {
+        if (!strstr(t->children[i]->tag, "number")) { continue; }
+        errno = 0;
+        x->data[n++] = strtod(t->children[i]->contents, NULL);
+        if (errno == ERANGE) {
+            lval_del(x);
+            return lval_error("invalid number");
+        }
+    }
+    x->count = n;
+    return x;
+}
+
+/*
+** String literal, without its quotes and with escapes replaced
+*/
+lval* lval_read_str(mpc_ast_t* t) {
+
+    size_t n = strlen(t->contents) - 2;
+    char* unescaped = malloc(n + 1);
+    memcpy(unescaped, t->contents + 1, n);
+    unescaped[n] = '\0';
+    unescaped = mpcf_unescape(unescaped);
+
+    lval* x = lval_str(unescaped, strlen(unescaped));
+    free(unescaped);
+    return x;
+}
+
 /*
 ** Add element to children of S-Expression (a)
 **
@@ -227,10 +682,18 @@ lval* lval_add(lval* a, lval* b) {
 
 }
 
-lval* lval_copy(lval* a) {
+/* Copy a single node; containers get a cell array for their children */
+static lval* lval_copy_node(lval* a) {
 
-    lval* c = malloc(sizeof(lval));
+    // Shared nodes are immutable so copying only takes a reference
+    if (a->refs > 0) {
+        a->refs++;
+        return a;
+    }
+
+    lval* c = calloc(1, sizeof(lval));
     c->type = a->type;
+    c->checked = a->checked;
 
     switch(a->type) {
 
@@ -240,57 +703,233 @@ lval* lval_copy(lval* a) {
         case LVAL_SYM: // copy string symbol
             c->sym = malloc(strlen(a->sym) + 1);
             strcpy(c->sym, a->sym);
+            c->slot = a->slot;
+            c->local = a->local;
+            c->fn = a->fn;
             break;
         case LVAL_ERROR: // copy string error
             c->err = malloc(strlen(a->err) + 1);
             strcpy(c->err, a->err);
             break;
+        case LVAL_REC:
+            c->rec = a->rec;
+            c->rec->refs++;
+            /* fall through */
         case LVAL_QEXPR:
         case LVAL_SEXPR:
             c->count = a->count;
             c->cell = malloc(sizeof(lval*) * a->count);
-            for(int i = 0; i < a->count; i++) {
-                c->cell[i] = lval_copy(a->cell[i]);
-            }
             break;
         case LVAL_FUN:
             c->fun = a->fun;
+            c->sig = a->sig;
+            c->memo = a->memo ? lmemo_ref(a->memo) : NULL;
+            if (a->rec) {
+                c->rec = a->rec;
+                c->rec->refs++;
+                c->field = a->field;
+            }
+            if (a->proto) {
+                c->proto = a->proto;
+                c->proto->refs++;
+                c->env = malloc(sizeof(lval*) * a->proto->ncaptured);
+                for (int i = 0; i < a->proto->ncaptured; i++) {
+                    c->env[i] = lval_copy(a->env[i]);
+                }
+            }
+            break;
+        case LVAL_SEQ:
+            c->seq = a->seq;
+            c->seq->refs++;
+            break;
+        case LVAL_MAP:
+        case LVAL_SET:
+            c->map = a->map;
+            c->map->refs++;
+            break;
+        case LVAL_MAT:
+            c->rows = a->rows;
+            c->cols = a->cols;
+            /* fall through */
+        case LVAL_ARR:
+            c->buf = a->buf;
+            c->buf->refs++;
+            c->data = a->data;
+            c->count = a->count;
+            break;
+        case LVAL_STR:
+            c->count = a->count;
+            memcpy(c->sso, a->sso, sizeof(c->sso));
+            c->str = a->str;
+            if (c->str) { c->str->refs++; }
+            break;
+        case LVAL_BYTES:
+            c->buf = a->buf;
+            c->buf->refs++;
+            c->bytes = a->bytes;
+            c->size = a->size;
             break;
     }
 
     return c;
-
 }
 
+lval* lval_copy(lval* a) {
+
+    lval* c = lval_copy_node(a);
+    if (c == a || !lval_is_expr(a)) { return c; }
+
+    lstack s;
+    lstack_init(&s);
+    lstack_push(&s, a, c, NULL);
+
+    // Fill in the children of every container copied so far, depth first
+    while (s.count) {
+        lwork* top = lstack_top(&s);
+
+        if (top->i == top->v->count) {
+            s.count--;
+            continue;
+        }
+
+        lval* a = top->v->cell[top->i];
+        lval* c = lval_copy_node(a);
+        top->w->cell[top->i++] = c;
+        if (c != a && lval_is_expr(a)) { lstack_push(&s, a, c, NULL); }
+    }
+
+    lstack_free(&s);
+    return c;
+}
 
 /*
-** Recursive funtion which returns either number or the result of expression
+** Funtion which returns either number or the result of expression
 ** In a simple lisp + 2 3
 ** The first child is tagged regex
 ** The second child is tagged operator (i.e. +)
 ** Third and Fourth child is tagged expression | number
+** Nested S-Expressions are evaluated with frames on a heap work stack
 */
-lval* lval_eval(lenv* e, lval* t) {
+/* Node of S-Expression t whose children are still t's (borrowed) */
+static lval* lval_lend(lval* t) {
+    lval* x = calloc(1, sizeof(lval));
+    x->type = LVAL_SEXPR;
+    x->checked = t->checked;
+    x->count = t->count;
+    x->cell = malloc(sizeof(lval*) * (t->count ? t->count : 1));
+    memcpy(x->cell, t->cell, sizeof(lval*) * t->count);
+    return x;
+}
 
-    if (t->type == LVAL_SYM) {
-        lval* x = lenv_get(e, t);
-        lval_del(t);
-        return x;
-    }
+/*
+** Evaluate t, consuming it, or only reading it if lent is set; with lent
+** set t is evaluated as an S-Expression whatever its type. Code which is
+** only read is never copied as a whole: a copy is made of each S-Expression
+** as it is reduced, holding its children until their values replace them,
+** and of the values the code contains, since those are returned.
+*/
+static lval* lval_eval_lent(lenv* e, lval* t, int lent) {
+
+    int code = lent;
+
+    // Each frame is an S-Expression whose children are being evaluated
+    lstack s;
+    lstack_init(&s);
+    lval* r = NULL;
+
+    // Call frame current on entry, restored when the stack empties
+    int base_fp = e->fp;
+    lproto* base_proto = e->proto;
+
+    while (1) {
+
+        // Evaluate t; S-Expressions push a frame, anything else is a value
+        if (t->type == LVAL_SYM) {
+            r = lenv_get(e, t);
+            if (!lent) { lval_del(t); }
+        } else if (t->type == LVAL_SEXPR || code) {
+            // Evaluation rewrites the expression in place
+            lwork* w = lstack_push(&s, lent ? lval_lend(t) : lval_own(t), NULL, e->proto);
+            w->fp = e->fp;
+            w->lent = lent;
+        } else {
+            r = lent ? lval_copy(t) : t;
+        }
+        t = NULL;
+        code = 0;
 
-    if (t->type == LVAL_SEXPR) {
-        return eval_sexpression(e, t);
+        while (s.count) {
+            lwork* top = lstack_top(&s);
+
+            // Store the value of the child just evaluated
+            if (r) {
+                top->v->cell[top->i++] = r;
+                r = NULL;
+            }
+
+            if (top->i < top->v->count) {
+                t = top->v->cell[top->i];
+                lent = top->lent;
+                break;
+            }
+
+            // All children evaluated; apply the head to the rest
+            lval* v = top->v;
+            int fp = top->fp;
+            lproto* proto = top->p;
+            s.count--;
+
+            // The body of a call runs in a different frame to its parent
+            lwork* parent = lstack_top(&s);
+            int parent_fp = parent ? parent->fp : base_fp;
+            lproto* parent_proto = parent ? parent->p : base_proto;
+            int owns = fp != parent_fp || proto != parent_proto;
+
+            // An expression in tail position replaces the frame rather than
+            // nesting inside it, so eval loops and tail calls run in
+            // constant space
+            int tail = 0;
+            lval* x = eval_apply(e, v, &tail);
+            if (tail == LVAL_TAIL_CALL && owns) {
+                lambda_reuse(e, fp);
+            }
+            if (tail) {
+                t = x;
+                lent = 0;
+                break;
+            }
+
+            r = x;
+            if (owns) {
+                lambda_leave(e, parent_fp, parent_proto);
+            }
+        }
+
+        if (!t) { break; }
     }
 
-    return t;
+    lstack_free(&s);
+    return r;
+}
+
+lval* lval_eval(lenv* e, lval* t) {
+    return lval_eval_lent(e, t, 0);
+}
+
+lval* lval_eval_code(lenv* e, lval* q) {
+    return lval_eval_lent(e, q, 1);
 }
 
 lval* eval_sexpression(lenv* e, lval* t) {
+    return lval_eval(e, t);
+}
 
-    // Evaluate children
-    for (int i = 0; i < t->count; i++) {
-        t->cell[i] = lval_eval(e, t->cell[i]);
-    }
+/*
+** Apply the head of an S-Expression whose children are evaluated to the rest
+** If the application is itself an expression to evaluate in tail position
+** (e.g. eval) it is returned unevaluated with *tail set
+*/
+lval* eval_apply(lenv* e, lval* t, int* tail) {
 
     // Don't bother with the rest if there are any errors
     for (int i = 0; i < t->count; i++) {
@@ -310,101 +949,340 @@ lval* eval_sexpression(lenv* e, lval* t) {
     }
 
     // Ensure first element is a symbol
+    const lsig* checked = t->checked;
     lval* f = lval_pop(t, 0);
     if(f->type != LVAL_FUN) {
         lval_del(f); lval_del(t);
         return lval_error("first element is not a function");
     }
 
-    lval* result = f->fun(e, t);
+    if (f->memo) {
+        lval* result = lmemo_call(e, f, t);
+        lval_del(f);
+        return result;
+    }
+
+    if (f->rec) {
+        lval* result = lrec_call(e, f, t);
+        lval_del(f);
+        return result;
+    }
+
+    // User defined functions bind a new call frame and return their body
+    if (f->proto) {
+        lval* x = lambda_enter(e, f, t);
+        *tail = x->type == LVAL_ERROR ? 0 : LVAL_TAIL_CALL;
+        return x;
+    }
+
+    // eval in tail position hands its expression back to the evaluator
+    if (f->fun == builtin_eval) {
+        lval_del(f);
+        lval* x = builtin_eval_expr(t);
+        *tail = x->type == LVAL_ERROR ? 0 : LVAL_TAIL_EVAL;
+        return x;
+    }
+
+    // Typed builtins are checked and unpacked here rather than by themselves,
+    // unless the call was already checked against the same builtin
+    lval* result = !f->sig ? f->fun(e, t)
+        : checked == f->sig && lsig_marks_valid ? lsig_invoke(e, f->sig, t)
+        : lsig_call(e, f->sig, t);
     lval_del(f);
     return result;
 
 }
 
-lval* builtin_op(lenv* e, lval* v, char* op) {
+/*
+** Call function value f on already evaluated arguments a
+** Used by builtins which take functions as arguments
+*/
+lval* lval_apply(lenv* e, lval* f, lval* a) {
+
+    if (f->memo || !f->proto) {
+        lval* result = f->memo ? lmemo_call(e, f, a)
+            : f->rec ? lrec_call(e, f, a)
+            : f->fun(e, a);
+        lval_del(f);
+        return result;
+    }
+
+    int fp = e->fp;
+    lproto* proto = e->proto;
+
+    lval* x = lambda_enter(e, f, a);
+    if (x->type == LVAL_ERROR) { return x; }
+
+    lval* result = lval_eval(e, x);
+    lambda_leave(e, fp, proto);
+    return result;
+}
+
+/*
+** Call builtin f directly on already evaluated arguments
+** Used by compiled code which resolved the function at compile time
+*/
+lval* lval_call(lenv* e, lbuiltin f, lval* a) {
 
-    /* Ensure all children are numbers */
-    for (int i = 0; i < v->count; i++) {
-        if (v->cell[i]->type != LVAL_NUM) {
-            lval_del(v);
-            return lval_error("Cannot operate on a non-number");
+    // Propagate errors exactly like eval_sexpression
+    for (int i = 0; i < a->count; i++) {
+        if (a->cell[i]->type == LVAL_ERROR) {
+            return lval_take(a, i);
         }
     }
 
-    lval* x = lval_pop(v, 0);
+    return f(e, a);
+}
+
+/*
+** Check arguments a against signature s in one pass and call the typed
+** entry point of the builtin with them unpacked
+**
+** Calls marked by lval_infer are known to pass the checks and go straight
+** to lsig_invoke.
+*/
+#define LSIG_LOCAL 16
+
+int lsig_marks_valid = 1;
+
+int lval_threads = 0;
+
+/* Error for a call to s with the wrong number of arguments (arg 0) or the wrong type of argument arg */
+lval* lsig_error(const lsig* s, int arg) {
+
+    char err[128];
+    if (arg == 0) {
+        snprintf(err, sizeof(err), "Function '%s' passed wrong number of arguments", s->name);
+    } else {
+        snprintf(err, sizeof(err), "Function '%s' passed incorrect type for argument %d", s->name, arg);
+    }
+    return lval_error(err);
+}
+
+/* Type argument i must have; extra arguments of a variadic function repeat the last required type */
+int lsig_arg_type(const lsig* s, int i) {
+    if (s->num && !s->span) { return LARG_NUM; }
+    if (s->max == LSIG_VARIADIC && i >= s->min) { i = s->min - 1; }
+    return i >= 0 && i < LSIG_TYPES ? s->types[i] : LARG_ANY;
+}
+
+/* Whether type t is one of the types union u stands for */
+static int larg_within(int t, int u) {
+    if (u == LARG_LIST) { return t == LARG_QEXPR || t == LARG_SEQ; }
+    if (u == LARG_ITEMS) { return t == LARG_LIST || t == LARG_ARR || larg_within(t, LARG_LIST); }
+    if (u == LARG_NUMS) { return t == LARG_NUM || t == LARG_QEXPR || t == LARG_ARR || t == LARG_MAT; }
+    return 0;
+}
 
-    if((strcmp(op, "-") == 0) && v->count == 0) {
-        x->value = -x->value;
+/* Whether a value of type have is one of type want: 1 if so, -1 if not, 0 if it may be */
+int lsig_type_match(int have, int want) {
+    if (want == LARG_ANY || have == want) { return 1; }
+    if (larg_within(have, want)) { return 1; }
+    if (have == LARG_ANY || larg_within(want, have)) { return 0; }
+    return -1;
+}
+
+/* Argument type of a value */
+static int larg_type(lval* v) {
+    switch (v->type) {
+        case LVAL_NUM: return LARG_NUM;
+        case LVAL_QEXPR: return LARG_QEXPR;
+        case LVAL_FUN: return LARG_FUN;
+        case LVAL_SEQ: return LARG_SEQ;
+        case LVAL_MAP: return LARG_MAP;
+        case LVAL_SET: return LARG_SET;
+        case LVAL_ARR: return LARG_ARR;
+        case LVAL_MAT: return LARG_MAT;
+        case LVAL_STR: return LARG_STR;
+        case LVAL_BYTES: return LARG_BYTES;
     }
+    return LARG_ANY;
+}
 
-    while(v->count > 0) {
+lval* lsig_call(lenv* e, const lsig* s, lval* a) {
 
-        lval* y = lval_pop(v, 0);
+    if (a->count < s->min || (s->max != LSIG_VARIADIC && a->count > s->max)) {
+        lval_del(a);
+        return lsig_error(s, 0);
+    }
 
-        if (strcmp(op, "+") == 0) {
-            x->value += y->value;
-        }
-        if (strcmp(op, "-") == 0) {
-            x->value -= y->value;
-        }
-        if (strcmp(op, "*") == 0) {
-            x->value *= y->value;
-        }
-        if (strcmp(op, "/") == 0) {
-            if (y->value == 0) {
-                lval_del(x);
-                lval_del(y);
-                lval_error("Cannot divide by zero");
-                break;
-            }
-            x->value /= y->value;
-        }
-        if (strcmp(op, "^") == 0) {
-            x->value = pow(x->value, y->value);
+    for (int i = 0; i < a->count; i++) {
+        int want = lsig_arg_type(s, i);
+        if (want == LARG_ANY) { continue; }
+
+        if (lsig_type_match(larg_type(a->cell[i]), want) != 1) {
+            lval_del(a);
+            return lsig_error(s, i + 1);
         }
+    }
 
-        lval_del(y);
+    return lsig_invoke(e, s, a);
+}
 
+/* Whether every argument in a is a number */
+static int lval_all_nums(lval* a) {
+    for (int i = 0; i < a->count; i++) {
+        if (a->cell[i]->type != LVAL_NUM) { return 0; }
     }
+    return 1;
+}
 
-    lval_del(v);
-    return x;
+/* Call the typed entry point of s on arguments a known to match it */
+lval* lsig_invoke(lenv* e, const lsig* s, lval* a) {
+
+    // Numbers are unpacked into a contiguous array
+    if (s->num && (!s->span || lval_all_nums(a))) {
+        double local[LSIG_LOCAL];
+        double* x = a->count <= LSIG_LOCAL ? local : malloc(sizeof(double) * a->count);
+        for (int i = 0; i < a->count; i++) { x[i] = a->cell[i]->value; }
+
+        lval* r = s->num(x, a->count);
+        if (x != local) { free(x); }
+        lval_del(a);
+        return r;
+    }
+
+    lval* r = s->span(e, a->cell, a->count);
+
+    // Free the arguments the builtin did not take
+    for (int i = 0; i < a->count; i++) {
+        if (a->cell[i]) { lval_del(a->cell[i]); }
+    }
+    a->count = 0;
+    lval_del(a);
+    return r;
+}
+
+/*
+** Arithmetic
+**
+** Computed in double precision and rounded to a number once at the end.
+** Lists of numbers are handled element-wise (see vec.c).
+*/
+static lval* num_add(double* x, int n) {
+    double r = x[0];
+    for (int i = 1; i < n; i++) { r += x[i]; }
+    return lval_num(r);
+}
+
+static lval* num_sub(double* x, int n) {
+    if (n == 1) { return lval_num(-x[0]); }
+    double r = x[0];
+    for (int i = 1; i < n; i++) { r -= x[i]; }
+    return lval_num(r);
 }
 
+static lval* num_mul(double* x, int n) {
+    double r = x[0];
+    for (int i = 1; i < n; i++) { r *= x[i]; }
+    return lval_num(r);
+}
+
+static lval* num_div(double* x, int n) {
+    double r = x[0];
+    for (int i = 1; i < n; i++) {
+        if (x[i] == 0) { return lval_error("Cannot divide by zero"); }
+        r /= x[i];
+    }
+    return lval_num(r);
+}
+
+static lval* num_pow(double* x, int n) {
+    double r = x[0];
+    for (int i = 1; i < n; i++) { r = pow(r, x[i]); }
+    return lval_num(r);
+}
+
+static const lsig sig_add = { "+", 1, LSIG_VARIADIC, { LARG_NUMS }, LARG_NUMS, num_add, lvec_add };
+static const lsig sig_sub = { "-", 1, LSIG_VARIADIC, { LARG_NUMS }, LARG_NUMS, num_sub, lvec_sub };
+static const lsig sig_mul = { "*", 1, LSIG_VARIADIC, { LARG_NUMS }, LARG_NUMS, num_mul, lvec_mul };
+static const lsig sig_div = { "/", 1, LSIG_VARIADIC, { LARG_NUMS }, LARG_NUMS, num_div, lvec_div };
+static const lsig sig_pow = { "^", 1, LSIG_VARIADIC, { LARG_NUMS }, LARG_NUMS, num_pow, lvec_pow };
+
 lval* builtin_add(lenv* e, lval* a) {
-    return builtin_op(e, a, "+");
+    return lsig_call(e, &sig_add, a);
 }
 
 lval* builtin_sub(lenv* e, lval* a) {
-    return builtin_op(e, a, "-");
+    return lsig_call(e, &sig_sub, a);
 }
 
 lval* builtin_mul(lenv* e, lval* a) {
-    return builtin_op(e, a, "*");
+    return lsig_call(e, &sig_mul, a);
 }
 
 lval* builtin_div(lenv* e, lval* a) {
-    return builtin_op(e, a, "/");
+    return lsig_call(e, &sig_div, a);
 }
 
 lval* builtin_pow(lenv* e, lval* a) {
-    return builtin_op(e, a, "^");
+    return lsig_call(e, &sig_pow, a);
 }
 
-/* Take q-expression and return q-expression with first element */
-lval* builtin_head(lenv*e, lval* a) {
+/*
+** Comparison
+**
+** Results are 1 for true and 0 for false. == and != compare any two values
+** structurally.
+*/
+static lval* num_lt(double* x, int n) { return lval_num(x[0] < x[1]); }
+static lval* num_gt(double* x, int n) { return lval_num(x[0] > x[1]); }
+static lval* num_le(double* x, int n) { return lval_num(x[0] <= x[1]); }
+static lval* num_ge(double* x, int n) { return lval_num(x[0] >= x[1]); }
+
+/* Numbers compare with C ==, so -0 equals 0 and NaN equals nothing */
+static lval* span_eq(lenv* e, lval** x, int n) {
+    if (x[0]->type == LVAL_NUM && x[1]->type == LVAL_NUM) { return lval_num(x[0]->value == x[1]->value); }
+    return lval_num(lval_eq(x[0], x[1]));
+}
 
-    /* too many arguments */
-    LVAL_ASSERT(a, a->count == 1, "Function 'head' passed too many arguments");
+static lval* span_ne(lenv* e, lval** x, int n) {
+    if (x[0]->type == LVAL_NUM && x[1]->type == LVAL_NUM) { return lval_num(x[0]->value != x[1]->value); }
+    return lval_num(!lval_eq(x[0], x[1]));
+}
+
+static const lsig sig_lt = { "<", 2, 2, { LARG_NUM, LARG_NUM }, LARG_NUM, num_lt, NULL };
+static const lsig sig_gt = { ">", 2, 2, { LARG_NUM, LARG_NUM }, LARG_NUM, num_gt, NULL };
+static const lsig sig_le = { "<=", 2, 2, { LARG_NUM, LARG_NUM }, LARG_NUM, num_le, NULL };
+static const lsig sig_ge = { ">=", 2, 2, { LARG_NUM, LARG_NUM }, LARG_NUM, num_ge, NULL };
+static const lsig sig_eq = { "==", 2, 2, { LARG_ANY, LARG_ANY }, LARG_NUM, NULL, span_eq };
+static const lsig sig_ne = { "!=", 2, 2, { LARG_ANY, LARG_ANY }, LARG_NUM, NULL, span_ne };
+
+lval* builtin_lt(lenv* e, lval* a) {
+    return lsig_call(e, &sig_lt, a);
+}
+
+lval* builtin_gt(lenv* e, lval* a) {
+    return lsig_call(e, &sig_gt, a);
+}
+
+lval* builtin_le(lenv* e, lval* a) {
+    return lsig_call(e, &sig_le, a);
+}
+
+lval* builtin_ge(lenv* e, lval* a) {
+    return lsig_call(e, &sig_ge, a);
+}
+
+lval* builtin_eq(lenv* e, lval* a) {
+    return lsig_call(e, &sig_eq, a);
+}
+
+lval* builtin_ne(lenv* e, lval* a) {
+    return lsig_call(e, &sig_ne, a);
+}
+
+/* Take q-expression and return q-expression with first element */
+static lval* span_head(lenv* e, lval** x, int n) {
 
-    /* not a q-expression */
-    LVAL_ASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function 'head' not a Q-Expression");
+    if (x[0]->type == LVAL_SEQ) { return lseq_head(e, x[0]); }
+    if (x[0]->type == LVAL_ARR) { return larr_head(x[0]); }
 
     /* no child elements */
-    LVAL_ASSERT(a, a->cell[0]->count != 0, "Function 'head' passed {}!");
+    if (x[0]->count == 0) { return lval_error("Function 'head' passed {}!"); }
 
-    lval* v = lval_take(a, 0);
+    lval* v = lval_own(x[0]);
+    x[0] = NULL;
 
     /* Delete elements not in the head */
     while (v->count > 1) {
@@ -416,75 +1294,100 @@ lval* builtin_head(lenv*e, lval* a) {
 }
 
 /* Takes q-expression and return q-expression with first element removed */
-lval* builtin_tail(lenv* e, lval* a) {
-
-    LVAL_ASSERT(a, a->count == 1, "Function 'head' passed too many arguments");
+static lval* span_tail(lenv* e, lval** x, int n) {
 
-    LVAL_ASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function 'head' not a Q-Expression");
+    if (x[0]->type == LVAL_SEQ) { return lseq_tail(x[0]); }
+    if (x[0]->type == LVAL_ARR) { return larr_tail(x[0]); }
 
-    LVAL_ASSERT(a, a->cell[0]->count != 0, "Function 'tail' passed");
+    if (x[0]->count == 0) { return lval_error("Function 'tail' passed {}!"); }
 
-    lval* v = lval_take(a, 0);
+    lval* v = lval_own(x[0]);
+    x[0] = NULL;
     lval_del(lval_pop(v, 0));
     return v;
 
 }
 
-/* Convert s-expression to q-expression */
-lval* builtin_list(lenv* e, lval* a) {
-    a->type = LVAL_QEXPR;
-    return a;
-}
-
 /* Joins q-expressions together */
-lval* builtin_join(lenv* e, lval* a) {
+static lval* span_join(lenv* e, lval** x, int n) {
 
-    // Make sure all children are q-expressions
-    for(int i = 0; i < a->count; i++) {
-        LVAL_ASSERT(a, a->cell[i]->type == LVAL_QEXPR, "Function 'join' incorrect type");
+    lval* v = lval_own(x[0]);
+    x[0] = NULL;
+    for (int i = 1; i < n; i++) {
+        v = lval_join(v, lval_own(x[i]));
+        x[i] = NULL;
     }
+    return v;
 
-    lval* x = lval_pop(a, 0);
-    while(a->count) { // By popping we reduce count
-        x = lval_join(x, lval_pop(a, 0));
-    }
+}
 
-    lval_del(a);
-    return x;
+/* Return number of elements in Q-expression */
+static lval* span_len(lenv* e, lval** x, int n) {
+    if (x[0]->type == LVAL_SEQ) { return lseq_len(e, x[0]); }
+    return lval_num(x[0]->count);
+}
+
+/* Return all but last element of q-expression */
+static lval* span_init(lenv* e, lval** x, int n) {
+
+    if (x[0]->count == 0) { return lval_error("Function 'init' passed {}!"); }
+
+    lval* v = lval_own(x[0]);
+    x[0] = NULL;
+    lval_del(lval_pop(v, v->count-1));
+    return v;
 
 }
 
-/* Evaluate q-expression */
-lval* builtin_eval(lenv* e, lval* a) {
+static const lsig sig_head = { "head", 1, 1, { LARG_ITEMS }, LARG_ITEMS, NULL, span_head };
+static const lsig sig_tail = { "tail", 1, 1, { LARG_ITEMS }, LARG_ITEMS, NULL, span_tail };
+static const lsig sig_join = { "join", 1, LSIG_VARIADIC, { LARG_QEXPR }, LARG_QEXPR, NULL, span_join };
+static const lsig sig_len = { "len", 1, 1, { LARG_ITEMS }, LARG_NUM, NULL, span_len };
+static const lsig sig_init = { "init", 1, 1, { LARG_QEXPR }, LARG_QEXPR, NULL, span_init };
 
-    LVAL_ASSERT(a, a->count == 1, "Function 'eval' passed too many arguments");
-    LVAL_ASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function 'eval' wrong type");
+lval* builtin_head(lenv* e, lval* a) {
+    return lsig_call(e, &sig_head, a);
+}
 
-    // Convert expression to s-expression then return evaluated result
-    lval* x = lval_take(a, 0);
-    x->type = LVAL_SEXPR;
-    return lval_eval(e, x);
+lval* builtin_tail(lenv* e, lval* a) {
+    return lsig_call(e, &sig_tail, a);
+}
+
+lval* builtin_join(lenv* e, lval* a) {
+    return lsig_call(e, &sig_join, a);
 }
 
-/* Return number of elements in Q-expression */
 lval* builtin_len(lenv* e, lval* a) {
+    return lsig_call(e, &sig_len, a);
+}
 
-    LVAL_ASSERT(a, a->count == 1, "Function 'eval' passed too many arguments");
-    LVAL_ASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function 'eval' wrong type");
+lval* builtin_init(lenv* e, lval* a) {
+    return lsig_call(e, &sig_init, a);
+}
 
-    lval* result = lval_num(lval_pop(a, 0)->count);
-    lval_del(a);
-    return result;
+/* Convert s-expression to q-expression */
+lval* builtin_list(lenv* e, lval* a) {
+    a->type = LVAL_QEXPR;
+    return a;
+}
 
+/* Evaluate q-expression */
+lval* builtin_eval(lenv* e, lval* a) {
+
+    lval* x = builtin_eval_expr(a);
+    return x->type == LVAL_ERROR ? x : lval_eval(e, x);
 }
 
-/* Return all but last element of q-expression */
-lval* builtin_init(lenv* e, lval* a) {
+/* Check the arguments of eval and return the expression it evaluates */
+lval* builtin_eval_expr(lval* a) {
 
-    lval* result = lval_take(a, 0);
-    lval_del(lval_pop(result, result->count-1));
-    return result;
+    LVAL_ASSERT(a, a->count == 1, "Function 'eval' passed too many arguments");
+    LVAL_ASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function 'eval' wrong type");
 
+    // Convert expression to s-expression
+    lval* x = lval_own(lval_take(a, 0));
+    x->type = LVAL_SEXPR;
+    return x;
 }
 
 /* Pop the child of lval at index i */
@@ -528,7 +1431,7 @@ lval* lval_join(lval* x, lval* y) {
 /*
 ** Methods
 */
-void lval_print(lval* p) {
+static void lval_print_atom(lval* p) {
     switch(p->type) {
         case LVAL_NUM: {
             printf("%f", p->value);
@@ -542,44 +1445,104 @@ void lval_print(lval* p) {
             printf("%s", p->sym);
             break;
         }
-        case LVAL_QEXPR: {
-            lval_print_qexpr(p);
+        case LVAL_FUN: {
+            if (p->proto) {
+                printf("(\\ ");
+                lval_print(p->proto->formals);
+                putchar(' ');
+                lval_print(p->proto->body);
+                putchar(')');
+            } else {
+                printf("<function>");
+            }
             break;
         }
-        case LVAL_SEXPR: {
-            lval_print_sexpr(p);
+        case LVAL_SEQ: {
+            printf("<sequence>");
             break;
         }
-        case LVAL_FUN: {
-            printf("<function>");
+        case LVAL_MAP: {
+            printf("<map>");
+            break;
+        }
+        case LVAL_SET: {
+            printf("<set>");
+            break;
+        }
+        case LVAL_ARR: {
+            putchar('[');
+            for (int i = 0; i < p->count; i++) {
+                printf(i ? " %f" : "%f", p->data[i]);
+            }
+            putchar(']');
+            break;
+        }
+        case LVAL_MAT: {
+            putchar('[');
+            for (int i = 0; i < p->rows; i++) {
+                printf(i ? " [" : "[");
+                for (int j = 0; j < p->cols; j++) {
+                    printf(j ? " %f" : "%f", p->data[(long)i * p->cols + j]);
+                }
+                putchar(']');
+            }
+            putchar(']');
+            break;
+        }
+        case LVAL_STR: {
+            lval_print_str(p);
+            break;
+        }
+        case LVAL_BYTES: {
+            printf("<bytes %ld>", p->size);
             break;
         }
     }
 }
 
-void lval_print_sexpr(lval* p) {
+void lval_print(lval* p) {
 
-    putchar('(');
+    lstack s;
+    lstack_init(&s);
 
-    for(int i = 0; i < p->count; i++) {
-        lval_print(p->cell[i]);
-        putchar(' ');
-    }
+    while (1) {
 
-    putchar(')');
+        if (p->type == LVAL_QEXPR || p->type == LVAL_SEXPR) {
+            putchar(p->type == LVAL_QEXPR ? '{' : '(');
+            lstack_push(&s, p, NULL, NULL);
+        } else if (p->type == LVAL_REC) {
+            printf("<%s ", p->rec->name);
+            lstack_push(&s, p, NULL, NULL);
+        } else {
+            lval_print_atom(p);
+            if (s.count) { putchar(' '); }
+        }
 
-}
+        // Close finished expressions and find the next child to print
+        p = NULL;
+        while (s.count) {
+            lwork* top = lstack_top(&s);
+            if (top->i < top->v->count) {
+                p = top->v->cell[top->i++];
+                break;
+            }
+            putchar(top->v->type == LVAL_QEXPR ? '}' : top->v->type == LVAL_REC ? '>' : ')');
+            s.count--;
+            if (s.count) { putchar(' '); }
+        }
 
-void lval_print_qexpr(lval* p) {
+        if (!p) { break; }
+    }
 
-    putchar('{');
+    lstack_free(&s);
+}
 
-    for(int i = 0; i < p->count; i++) {
-        lval_print(p->cell[i]);
-        putchar(' ');
-    }
+void lval_print_sexpr(lval* p) {
+    lval_print(p);
+}
 
-    putchar('}');
+void lval_print_qexpr(lval* p) {
+    lval_print(p);
 }
 
 void lval_println(lval *p) {
@@ -6,32 +6,125 @@
 /* Forward declarations */
 struct lenv;
 struct lval;
+struct lmemo;
+struct lproto;
+struct lseq;
+struct lrec;
+struct lmap;
+struct lbuf;
+struct lstr;
 
 typedef struct lval lval;
 typedef struct lenv lenv;
-
-enum LVAL_TYPE { LVAL_NUM, LVAL_ERROR, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUN };
+typedef struct lmemo lmemo;
+typedef struct lproto lproto;
+typedef struct lseq lseq;
+typedef struct lrec lrec;
+typedef struct lmap lmap;
+typedef struct lbuf lbuf;
+typedef struct lstr lstr;
+
+enum LVAL_TYPE { LVAL_NUM, LVAL_ERROR, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUN, LVAL_SEQ, LVAL_REC,
+                  LVAL_MAP, LVAL_SET, LVAL_ARR, LVAL_MAT, LVAL_STR,
+                  LVAL_BYTES };
 
 typedef lval*(*lbuiltin)(lenv*, lval*);
 
+/*
+** Builtin signatures
+**
+** A builtin registered with a signature has its arity and argument types
+** checked once by the dispatcher (lsig_call), which then passes the
+** arguments unpacked: numbers as a contiguous array of doubles, anything
+** else as a span of the argument cells. A span builtin may take ownership
+** of an argument by setting its cell to NULL; the rest are freed after it
+** returns. A builtin with both entry points takes numbers through the
+** first whenever all of its arguments are numbers, and cells otherwise.
+*/
+enum LARG_TYPE { LARG_ANY, LARG_NUM, LARG_QEXPR, LARG_FUN, LARG_SEQ,
+                 LARG_LIST, // Either a Q-Expression or a sequence
+                 LARG_MAP, LARG_SET, LARG_ARR, LARG_MAT, LARG_STR, LARG_BYTES,
+                 LARG_ITEMS, // A list or an array
+                 LARG_NUMS   // A number, or a Q-Expression, array or matrix of numbers
+               };
+
+typedef lval*(*lbuiltin_num)(double* x, int n);
+typedef lval*(*lbuiltin_span)(lenv* e, lval** x, int n);
+
+#define LSIG_VARIADIC -1
+#define LSIG_TYPES 4
+#define LSTR_INLINE 15 // Longest string stored inside its lval (see str.c)
+
+typedef struct {
+    char* name;             // Name used in error messages
+    int min;                // Fewest arguments
+    int max;                // Most arguments (LSIG_VARIADIC for no limit)
+    int types[LSIG_TYPES];  // Type of each argument (see lsig_arg_type)
+    int result;             // Type of the value returned on success
+    lbuiltin_num num;       // Entry point taking numbers (all LARG_NUM)
+    lbuiltin_span span;     // Entry point taking argument cells
+} lsig;
+
 /* Defining struct */
 struct lenv {
-    int count;
-    char** syms;
-    lval** vals;
+    int count;   // Number of slots allocated in vals
+    lval** vals; // Value of each symbol slot (NULL if unbound)
+
+    /* Call frames of user defined functions (see lambda.c) */
+    lval** locals;   // Slots of every active call, innermost last
+    int nlocals;
+    int locals_size;
+    int fp;          // First slot of the current call frame
+    lproto* proto;   // Function of the current call (NULL at top level)
 };
 
 struct lval {
     int type;
-
-    float value;
-    char* err;
-    char* sym;
-
-    lbuiltin fun;
-
-    int count; // Stores length of cell list
-    struct lval** cell;
+    int count; // Stores length of cell list (or fields of a record, or elements of an array or matrix, or bytes of a string)
+    int refs;  // Owners of a hash-consed node (0 if not shared)
+    struct lval** cell;  // Children of an S-Expression, Q-Expression or record
+    const lsig* checked; // Signature this call was checked against ahead of time (see opt.c)
+    unsigned long hash;  // Structural hash of a hash-consed node
+
+    /* Fields of each type, sharing storage, so a value only pays for the largest */
+    union {
+        float value; // LVAL_NUM
+        char* err;   // LVAL_ERROR
+
+        struct { // LVAL_SYM
+            char* sym;
+            int slot;  // Symbol slot assigned by lval_resolve (-1 if unresolved)
+            int local; // Call frame position of a symbol naming a local
+            int fn;    // Function the local belongs to (0 if not a local)
+        };
+
+        struct { // LVAL_FUN, and rec alone for LVAL_REC
+            lbuiltin fun;
+            const lsig* sig; // Signature of a typed builtin (NULL if untyped)
+            lmemo* memo;     // Result cache of a memoized function (see memo.c)
+            lproto* proto;   // Compiled user defined function (NULL for builtins)
+            lval** env;      // Captured variables of a user defined function
+            lrec* rec;       // Type of a record, or of a record function (see record.c)
+            int field;       // Field a record accessor reads, or LREC_NEW / LREC_IS
+        };
+
+        lseq* seq; // LVAL_SEQ: recipe of a lazy sequence (see seq.c)
+        lmap* map; // LVAL_MAP, LVAL_SET: table of a hash map or set (see map.c)
+
+        struct { // LVAL_ARR, LVAL_MAT, LVAL_BYTES
+            lbuf* buf;    // Buffer holding the elements (see array.c)
+            double* data; // First element of an array or matrix, within buf
+            char* bytes;  // First byte of a bytevector, within buf (see bytes.c)
+            long size;    // Length of a bytevector, which may not fit in count
+            int rows;     // Shape of a matrix (see matrix.c)
+            int cols;
+        };
+
+        struct { // LVAL_STR
+            lstr* str; // Contents of a long string (see str.c)
+            char sso[LSTR_INLINE + 1]; // Contents of a short string, stored inline
+        };
+    };
 };
 
 /* Constructors */
@@ -48,36 +141,74 @@ lval* lval_fun(lbuiltin f);
 void lenv_del(lenv* e);
 void lval_del(lval* v);
 
+/* Symbol slots */
+int lsym_slot(char* name);
+char* lsym_name(int slot);
+lval* lval_resolve(lval* t);
+
 /* Environment methods */
 lval* lenv_get(lenv* e, lval* k);
 void lenv_put(lenv*e, lval* k, lval* v);
-void lenv_add_builtin(lenv* e, char* name, lbuiltin func);
+void lenv_add_builtin(lenv* e, char* name, lbuiltin func, const lsig* sig);
 void lenv_add_builtins(lenv* e);
 
+/* Pure builtin registry */
+void lbuiltin_mark_pure(lbuiltin f);
+int lbuiltin_is_pure(lbuiltin f);
+
 /* Reading Expressions */
 lval* lval_read_num(mpc_ast_t* t);
+lval* lval_read_array(mpc_ast_t* t);
+lval* lval_read_str(mpc_ast_t* t);
 lval* lval_read(mpc_ast_t* t);
 lval* lval_add(lval* a, lval* b);
 lval* lval_copy(lval* a);
 
 /* Evaluating Expressions */
+#define LVAL_TAIL_EVAL 1 // Evaluate the expression in the current call frame
+#define LVAL_TAIL_CALL 2 // Evaluate the body of a call just entered
+
 lval* lval_eval(lenv* e, lval* t);
+
+/* Evaluate the code in Q- or S-Expression q (borrowed) without copying it
+** whole, for code run many times such as a loop body */
+lval* lval_eval_code(lenv* e, lval* q);
 lval* eval_sexpression(lenv* e, lval* t);
+lval* eval_apply(lenv* e, lval* t, int* tail);
+lval* lval_call(lenv* e, lbuiltin f, lval* a);
+lval* lval_apply(lenv* e, lval* f, lval* a);
+lval* lsig_call(lenv* e, const lsig* s, lval* a);
+lval* lsig_invoke(lenv* e, const lsig* s, lval* a);
+lval* lsig_error(const lsig* s, int arg);
+int lsig_arg_type(const lsig* s, int i);
+int lsig_type_match(int have, int want);
 
-/* Built in operators */
-lval* builtin_op(lenv* e, lval* v, char* op);
+/* Cleared once a typed builtin is rebound, which invalidates checked calls */
+extern int lsig_marks_valid;
 
+/* Worker threads used by parallel builtins such as sort (0 for one per core) */
+extern int lval_threads;
+
+/* Built in operators */
 lval* builtin_add(lenv* e, lval* a);
 lval* builtin_sub(lenv* e, lval* a);
 lval* builtin_mul(lenv* e, lval* a);
 lval* builtin_div(lenv* e, lval* a);
 lval* builtin_pow(lenv* e, lval* a);
 
+lval* builtin_lt(lenv* e, lval* a);
+lval* builtin_gt(lenv* e, lval* a);
+lval* builtin_le(lenv* e, lval* a);
+lval* builtin_ge(lenv* e, lval* a);
+lval* builtin_eq(lenv* e, lval* a);
+lval* builtin_ne(lenv* e, lval* a);
+
 lval* builtin_head(lenv* e, lval* a);
 lval* builtin_tail(lenv* e, lval* a);
 lval* builtin_list(lenv* e, lval* a);
 lval* builtin_join(lenv* e, lval* a);
 lval* builtin_eval(lenv* e, lval* a);
+lval* builtin_eval_expr(lval* a);
 lval* builtin_len(lenv* e, lval* a);
 lval* builtin_init(lenv* e, lval* a);
 
@@ -0,0 +1,377 @@
+#include "map.h"
+#include "hcons.h"
+#include "seq.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define LMAP_GROUP 16
+#define LMAP_EMPTY ((signed char)-128)
+#define LMAP_DELETED ((signed char)-2)
+
+/*
+** Control bytes
+**
+** A full slot holds 0..127, so empty and deleted slots are exactly those
+** with the high bit set.
+*/
+
+/* Bitmask of the slots of the group at g whose control byte is c */
+static unsigned lmap_match(const signed char* g, signed char c) {
+#ifdef __SSE2__
+    __m128i x = _mm_loadu_si128((const __m128i*)g);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8(c)));
+#else
+    unsigned bits = 0;
+    for (int i = 0; i < LMAP_GROUP; i++) { bits |= (unsigned)(g[i] == c) << i; }
+    return bits;
+#endif
+}
+
+/* Bitmask of the slots of the group at g which are empty or deleted */
+static unsigned lmap_match_free(const signed char* g) {
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)g));
+#else
+    unsigned bits = 0;
+    for (int i = 0; i < LMAP_GROUP; i++) { bits |= (unsigned)(g[i] < 0) << i; }
+    return bits;
+#endif
+}
+
+/* lval_hash mixed so that its low bits (the control byte) are well spread */
+static unsigned long lmap_hash(lval* k) {
+    unsigned long h = lval_hash(k);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdUL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53UL;
+    h ^= h >> 33;
+    return h;
+}
+
+/*
+** Probing visits whole groups: the group the hash selects, then groups
+** 1, 2, 3... further on (triangular steps), which reaches every group of a
+** power of two sized table. A search can stop at a group with an empty slot.
+*/
+static long lmap_find(lmap* m, lval* k, unsigned long h) {
+
+    if (m->cap == 0) { return -1; }
+
+    unsigned long mask = m->cap - 1;
+    unsigned long pos = (h >> 7) & mask & ~(unsigned long)(LMAP_GROUP - 1);
+
+    for (unsigned long step = LMAP_GROUP; ; step += LMAP_GROUP) {
+        signed char* g = m->ctrl + pos;
+        for (unsigned bits = lmap_match(g, h & 0x7f); bits; bits &= bits - 1) {
+            long s = pos + __builtin_ctz(bits);
+            if (m->hashes[s] == h && lval_eq(m->keys[s], k)) { return s; }
+        }
+        if (lmap_match(g, LMAP_EMPTY)) { return -1; }
+        pos = (pos + step) & mask;
+    }
+}
+
+/* First empty or deleted slot on the probe sequence of h */
+static long lmap_free_slot(lmap* m, unsigned long h) {
+
+    unsigned long mask = m->cap - 1;
+    unsigned long pos = (h >> 7) & mask & ~(unsigned long)(LMAP_GROUP - 1);
+
+    for (unsigned long step = LMAP_GROUP; ; step += LMAP_GROUP) {
+        unsigned bits = lmap_match_free(m->ctrl + pos);
+        if (bits) { return pos + __builtin_ctz(bits); }
+        pos = (pos + step) & mask;
+    }
+}
+
+/* Move every key to a table of cap slots */
+static void lmap_resize(lmap* m, long cap) {
+
+    lmap old = *m;
+
+    m->cap = cap;
+    m->ctrl = malloc(cap);
+    memset(m->ctrl, LMAP_EMPTY, cap);
+    m->hashes = malloc(sizeof(unsigned long) * cap);
+    m->keys = malloc(sizeof(lval*) * cap);
+    m->vals = m->set ? NULL : malloc(sizeof(lval*) * cap);
+
+    for (long i = 0; i < old.cap; i++) {
+        if (old.ctrl[i] < 0) { continue; }
+        long s = lmap_free_slot(m, old.hashes[i]);
+        m->ctrl[s] = old.ctrl[i];
+        m->hashes[s] = old.hashes[i];
+        m->keys[s] = old.keys[i];
+        if (!m->set) { m->vals[s] = old.vals[i]; }
+    }
+
+    // At most 7/8 of the slots are ever full or deleted
+    m->growth = cap - cap / 8 - m->size;
+
+    free(old.ctrl);
+    free(old.hashes);
+    free(old.keys);
+    free(old.vals);
+}
+
+lval* lval_map(lmap* m) {
+    lval* v = calloc(1, sizeof(lval));
+    v->type = m->set ? LVAL_SET : LVAL_MAP;
+    v->map = m;
+    return v;
+}
+
+lmap* lmap_new(int set) {
+    lmap* m = calloc(1, sizeof(lmap));
+    m->refs = 1;
+    m->set = set;
+    return m;
+}
+
+void lmap_release(lmap* m) {
+
+    if (--m->refs > 0) { return; }
+
+    for (long i = 0; i < m->cap; i++) {
+        if (m->ctrl[i] < 0) { continue; }
+        lval_del(m->keys[i]);
+        if (!m->set) { lval_del(m->vals[i]); }
+    }
+    free(m->ctrl);
+    free(m->hashes);
+    free(m->keys);
+    free(m->vals);
+    free(m);
+}
+
+lval* lmap_get(lmap* m, lval* k) {
+    long s = lmap_find(m, k, lmap_hash(k));
+    if (s < 0) { return NULL; }
+    return m->set ? m->keys[s] : m->vals[s];
+}
+
+void lmap_put(lmap* m, lval* k, lval* v) {
+
+    unsigned long h = lmap_hash(k);
+    long s = lmap_find(m, k, h);
+
+    if (s >= 0) {
+        lval_del(k);
+        if (!m->set) {
+            lval_del(m->vals[s]);
+            m->vals[s] = v;
+        }
+        return;
+    }
+
+    // Out of empty slots: grow, or just clear out deleted slots if the
+    // table is less than half full
+    if (m->growth == 0) {
+        long cap = m->cap == 0 ? LMAP_GROUP
+            : 2 * (m->size + 1) > m->cap ? 2 * m->cap : m->cap;
+        lmap_resize(m, cap);
+    }
+
+    s = lmap_free_slot(m, h);
+    if (m->ctrl[s] == LMAP_EMPTY) { m->growth--; }
+    m->ctrl[s] = h & 0x7f;
+    m->hashes[s] = h;
+    m->keys[s] = k;
+    if (!m->set) { m->vals[s] = v; }
+    m->size++;
+}
+
+int lmap_del(lmap* m, lval* k) {
+
+    long s = lmap_find(m, k, lmap_hash(k));
+    if (s < 0) { return 0; }
+
+    lval_del(m->keys[s]);
+    if (!m->set) { lval_del(m->vals[s]); }
+    m->size--;
+
+    // Searches already stop at a group with an empty slot, so the slot can
+    // be emptied outright; otherwise it must stay in the probe sequence
+    signed char* g = m->ctrl + (s & ~(long)(LMAP_GROUP - 1));
+    if (lmap_match(g, LMAP_EMPTY)) {
+        m->ctrl[s] = LMAP_EMPTY;
+        m->growth++;
+    } else {
+        m->ctrl[s] = LMAP_DELETED;
+    }
+    return 1;
+}
+
+/*
+** Builtins
+*/
+
+/* Table of value v, or NULL if v is not a map (or set, if sets are allowed) */
+static lmap* lmap_of(lval* v, int sets) {
+    if (v->type == LVAL_MAP || (sets && v->type == LVAL_SET)) { return v->map; }
+    return NULL;
+}
+
+/* Elements of the list x[i], collecting it if it is a sequence */
+static lval* lmap_elements(lenv* e, lval** x, int i) {
+    lval* l = x[i]->type == LVAL_SEQ ? lseq_collect(e, x[i]) : x[i];
+    if (l == x[i]) { x[i] = NULL; }
+    return l;
+}
+
+/* Map of keys and values in turn: hash-map {k v ...} */
+static lval* span_hash_map(lenv* e, lval** x, int n) {
+
+    lval* l = lmap_elements(e, x, 0);
+    if (l->type == LVAL_ERROR) { return l; }
+    if (l->count % 2) {
+        lval_del(l);
+        return lval_error("Function 'hash-map' passed a key without a value");
+    }
+
+    lmap* m = lmap_new(0);
+    for (int i = 0; i < l->count; i += 2) {
+        lmap_put(m, lval_copy(l->cell[i]), lval_copy(l->cell[i+1]));
+    }
+    lval_del(l);
+    return lval_map(m);
+}
+
+/* Set of the elements: hash-set {x ...} */
+static lval* span_hash_set(lenv* e, lval** x, int n) {
+
+    lval* l = lmap_elements(e, x, 0);
+    if (l->type == LVAL_ERROR) { return l; }
+
+    lmap* m = lmap_new(1);
+    for (int i = 0; i < l->count; i++) {
+        lmap_put(m, lval_copy(l->cell[i]), NULL);
+    }
+    lval_del(l);
+    return lval_map(m);
+}
+
+/* Add to a table and return it: insert m k v, insert s x */
+static lval* span_insert(lenv* e, lval** x, int n) {
+
+    lmap* m = lmap_of(x[0], 1);
+    if (!m) { return lsig_error(&sig_insert, 1); }
+    if (n != (m->set ? 2 : 3)) { return lsig_error(&sig_insert, 0); }
+
+    lmap_put(m, x[1], m->set ? NULL : x[2]);
+    x[1] = NULL;
+    if (!m->set) { x[2] = NULL; }
+
+    lval* t = x[0];
+    x[0] = NULL;
+    return t;
+}
+
+/* Value of a key, or a default if it is missing: lookup m k [default] */
+static lval* span_lookup(lenv* e, lval** x, int n) {
+
+    lval* v = lmap_get(x[0]->map, x[1]);
+    if (v) { return lval_copy(v); }
+    if (n < 3) { return lval_error("Function 'lookup' key not found"); }
+
+    v = x[2];
+    x[2] = NULL;
+    return v;
+}
+
+/* 1 if a table has a key, else 0: contains t k */
+static lval* span_contains(lenv* e, lval** x, int n) {
+    lmap* m = lmap_of(x[0], 1);
+    if (!m) { return lsig_error(&sig_contains, 1); }
+    return lval_num(lmap_get(m, x[1]) != NULL);
+}
+
+/* Remove a key from a table and return it: delete t k */
+static lval* span_delete(lenv* e, lval** x, int n) {
+
+    lmap* m = lmap_of(x[0], 1);
+    if (!m) { return lsig_error(&sig_delete, 1); }
+
+    lmap_del(m, x[1]);
+    lval* t = x[0];
+    x[0] = NULL;
+    return t;
+}
+
+/* Keys (or values) of a table in storage order */
+static lval* lmap_list(lmap* m, int vals) {
+
+    lval* l = lval_qexpr();
+    l->cell = malloc(sizeof(lval*) * (m->size ? m->size : 1));
+    for (long i = 0; i < m->cap; i++) {
+        if (m->ctrl[i] < 0) { continue; }
+        l->cell[l->count++] = lval_copy(vals ? m->vals[i] : m->keys[i]);
+    }
+    return l;
+}
+
+static lval* span_keys(lenv* e, lval** x, int n) {
+    lmap* m = lmap_of(x[0], 1);
+    if (!m) { return lsig_error(&sig_keys, 1); }
+    return lmap_list(m, 0);
+}
+
+static lval* span_vals(lenv* e, lval** x, int n) {
+    return lmap_list(x[0]->map, 1);
+}
+
+static lval* span_size(lenv* e, lval** x, int n) {
+    lmap* m = lmap_of(x[0], 1);
+    if (!m) { return lsig_error(&sig_size, 1); }
+    return lval_num(m->size);
+}
+
+const lsig sig_hash_map = { "hash-map", 1, 1, { LARG_LIST }, LARG_MAP, NULL, span_hash_map };
+const lsig sig_hash_set = { "hash-set", 1, 1, { LARG_LIST }, LARG_SET, NULL, span_hash_set };
+const lsig sig_insert = { "insert", 2, 3, { LARG_ANY, LARG_ANY, LARG_ANY }, LARG_ANY, NULL, span_insert };
+const lsig sig_lookup = { "lookup", 2, 3, { LARG_MAP, LARG_ANY, LARG_ANY }, LARG_ANY, NULL, span_lookup };
+const lsig sig_contains = { "contains", 2, 2, { LARG_ANY, LARG_ANY }, LARG_NUM, NULL, span_contains };
+const lsig sig_delete = { "delete", 2, 2, { LARG_ANY, LARG_ANY }, LARG_ANY, NULL, span_delete };
+const lsig sig_keys = { "keys", 1, 1, { LARG_ANY }, LARG_QEXPR, NULL, span_keys };
+const lsig sig_vals = { "vals", 1, 1, { LARG_MAP }, LARG_QEXPR, NULL, span_vals };
+const lsig sig_size = { "size", 1, 1, { LARG_ANY }, LARG_NUM, NULL, span_size };
+
+lval* builtin_hash_map(lenv* e, lval* a) {
+    return lsig_call(e, &sig_hash_map, a);
+}
+
+lval* builtin_hash_set(lenv* e, lval* a) {
+    return lsig_call(e, &sig_hash_set, a);
+}
+
+lval* builtin_insert(lenv* e, lval* a) {
+    return lsig_call(e, &sig_insert, a);
+}
+
+lval* builtin_lookup(lenv* e, lval* a) {
+    return lsig_call(e, &sig_lookup, a);
+}
+
+lval* builtin_contains(lenv* e, lval* a) {
+    return lsig_call(e, &sig_contains, a);
+}
+
+lval* builtin_delete(lenv* e, lval* a) {
+    return lsig_call(e, &sig_delete, a);
+}
+
+lval* builtin_keys(lenv* e, lval* a) {
+    return lsig_call(e, &sig_keys, a);
+}
+
+lval* builtin_vals(lenv* e, lval* a) {
+    return lsig_call(e, &sig_vals, a);
+}
+
+lval* builtin_size(lenv* e, lval* a) {
+    return lsig_call(e, &sig_size, a);
+}
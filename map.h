@@ -0,0 +1,62 @@
+#ifndef MAP_H_
+#define MAP_H_
+
+#include "lval.h"
+
+/*
+** Hash maps and sets
+**
+** Open addressing in the style of a Swiss table. Every slot has a control
+** byte: empty, deleted, or the low 7 bits of the hash of the key stored
+** there. Slots are probed a group of 16 at a time by comparing all of the
+** group's control bytes at once (with SSE2 where available), so a lookup
+** usually checks a single key with lval_eq.
+**
+** Keys are hashed and compared structurally (see lval_hash), so numbers,
+** symbols, Q-Expressions and records all work as keys. Numbers match as
+** they do under ==: -0 finds the key 0, and a NaN key is never found.
+**
+** Unlike other values, a table is mutable: insert and delete change it in
+** place and every copy of the value refers to the same table. This keeps
+** updating a table bound to a variable O(1) instead of copying it.
+*/
+struct lmap {
+    int refs;
+    int set;              // Keys only (vals is NULL)
+    long size;            // Keys stored
+    long cap;             // Slots; a power of two and a multiple of the group size
+    long growth;          // Empty slots which may be filled before a rehash
+    signed char* ctrl;    // Control byte of each slot
+    unsigned long* hashes;
+    lval** keys;
+    lval** vals;
+};
+
+lval* lval_map(lmap* m);
+lmap* lmap_new(int set);
+void lmap_release(lmap* m);
+
+/* Value stored under k (borrowed), or NULL */
+lval* lmap_get(lmap* m, lval* k);
+
+/* Store v under k, replacing any value there; consumes k and v (NULL for a set) */
+void lmap_put(lmap* m, lval* k, lval* v);
+
+/* Remove k; returns 0 if it was not there */
+int lmap_del(lmap* m, lval* k);
+
+/* Builtins */
+extern const lsig sig_hash_map, sig_hash_set, sig_insert, sig_lookup,
+    sig_contains, sig_delete, sig_keys, sig_vals, sig_size;
+
+lval* builtin_hash_map(lenv* e, lval* a);
+lval* builtin_hash_set(lenv* e, lval* a);
+lval* builtin_insert(lenv* e, lval* a);
+lval* builtin_lookup(lenv* e, lval* a);
+lval* builtin_contains(lenv* e, lval* a);
+lval* builtin_delete(lenv* e, lval* a);
+lval* builtin_keys(lenv* e, lval* a);
+lval* builtin_vals(lenv* e, lval* a);
+lval* builtin_size(lenv* e, lval* a);
+
+#endif // MAP_H_
@@ -0,0 +1,342 @@
+#include "matrix.h"
+#include "array.h"
+#include "simd.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Register tile and cache blocks of matmul (a panel of b is LMAT_NR wide) */
+#define LMAT_MR 4
+#define LMAT_NR (2 * LVEC_WIDTH)
+#define LMAT_KC 256
+#define LMAT_MC 96
+#define LMAT_NC 2048
+
+lval* lval_matrix(long rows, long cols) {
+    lval* v = calloc(1, sizeof(lval));
+    v->type = LVAL_MAT;
+    v->buf = lbuf_new(sizeof(double) * rows * cols);
+    v->data = v->buf->data;
+    v->count = rows * cols;
+    v->rows = rows;
+    v->cols = cols;
+    return v;
+}
+
+lval* lval_matrix_of(long rows, long cols, const double* x) {
+    lval* v = lval_matrix(rows, cols);
+    memcpy(v->data, x, sizeof(double) * rows * cols);
+    return v;
+}
+
+lval* lmat_to_list(lval* m) {
+    lval* r = lval_qexpr();
+    for (int i = 0; i < m->rows; i++) {
+        lval* row = lval_qexpr();
+        row->count = m->cols;
+        row->cell = malloc(sizeof(lval*) * m->cols);
+        for (int j = 0; j < m->cols; j++) {
+            row->cell[j] = lval_num(m->data[(long)i * m->cols + j]);
+        }
+        lval_add(r, row);
+    }
+    return r;
+}
+
+/*
+** Packing
+**
+** A block of a is stored as panels of LMAT_MR rows, each column of a panel
+** contiguous; a block of b as panels of LMAT_NR columns, each row of a
+** panel contiguous. Panels past the edge of the matrix are padded with
+** zeros so the kernel always computes a whole tile.
+*/
+static void lmat_pack_a(double* p, const double* a, long lda, long mc, long kc) {
+    for (long i = 0; i < mc; i += LMAT_MR) {
+        for (long k = 0; k < kc; k++) {
+            for (int r = 0; r < LMAT_MR; r++) {
+                *p++ = i + r < mc ? a[(i + r) * lda + k] : 0;
+            }
+        }
+    }
+}
+
+static void lmat_pack_b(double* p, const double* b, long ldb, long kc, long nc) {
+    for (long j = 0; j < nc; j += LMAT_NR) {
+        long w = nc - j < LMAT_NR ? nc - j : LMAT_NR;
+        for (long k = 0; k < kc; k++) {
+            const double* row = b + k * ldb + j;
+            for (int c = 0; c < LMAT_NR; c++) { *p++ = c < w ? row[c] : 0; }
+        }
+    }
+}
+
+/*
+** Kernel
+**
+** c[0..mr][0..nr] += a panel times b panel, over kc. The tile is held in
+** eight registers: LMAT_MR rows of two registers each.
+*/
+static void lmat_kernel(long kc, const double* a, const double* b, double* c, long ldc, int mr, int nr) {
+
+    vreg c00 = vzero(), c01 = vzero(), c10 = vzero(), c11 = vzero();
+    vreg c20 = vzero(), c21 = vzero(), c30 = vzero(), c31 = vzero();
+
+    for (long k = 0; k < kc; k++) {
+        vreg b0 = vload(b);
+        vreg b1 = vload(b + LVEC_WIDTH);
+        vreg x;
+        x = vset1(a[0]); c00 = vfma(x, b0, c00); c01 = vfma(x, b1, c01);
+        x = vset1(a[1]); c10 = vfma(x, b0, c10); c11 = vfma(x, b1, c11);
+        x = vset1(a[2]); c20 = vfma(x, b0, c20); c21 = vfma(x, b1, c21);
+        x = vset1(a[3]); c30 = vfma(x, b0, c30); c31 = vfma(x, b1, c31);
+        a += LMAT_MR;
+        b += LMAT_NR;
+    }
+
+    double t[LMAT_MR * LMAT_NR];
+    double* out = mr == LMAT_MR && nr == LMAT_NR ? NULL : t;
+#define LMAT_STORE(i, r0, r1)                                                   \
+    if (out) {                                                                  \
+        vstore(t + i * LMAT_NR, r0);                                            \
+        vstore(t + i * LMAT_NR + LVEC_WIDTH, r1);                               \
+    } else {                                                                    \
+        vstore(c + i * ldc, vadd(vload(c + i * ldc), r0));                      \
+        vstore(c + i * ldc + LVEC_WIDTH, vadd(vload(c + i * ldc + LVEC_WIDTH), r1)); \
+    }
+    LMAT_STORE(0, c00, c01)
+    LMAT_STORE(1, c10, c11)
+    LMAT_STORE(2, c20, c21)
+    LMAT_STORE(3, c30, c31)
+#undef LMAT_STORE
+
+    // Edge tiles add only the part inside the matrix
+    if (out) {
+        for (int i = 0; i < mr; i++) {
+            for (int j = 0; j < nr; j++) { c[i * ldc + j] += t[i * LMAT_NR + j]; }
+        }
+    }
+}
+
+/*
+** Blocked product
+**
+** c (m x n, zeroed) += a (m x k) times b (k x n), for rows [r0, r1) of c
+*/
+typedef struct {
+    const double* a;
+    const double* b;
+    double* c;
+    long m, n, k;
+    long r0, r1;
+} lmat_task;
+
+static void* lmat_gemm(void* p) {
+
+    lmat_task* t = p;
+    long n = t->n, k = t->k;
+
+    double* pa;
+    double* pb;
+    if (posix_memalign((void**)&pa, LBUF_ALIGN, sizeof(double) * LMAT_MC * LMAT_KC)) { abort(); }
+    if (posix_memalign((void**)&pb, LBUF_ALIGN, sizeof(double) * LMAT_KC * (LMAT_NC + LMAT_NR))) { abort(); }
+
+    for (long jc = 0; jc < n; jc += LMAT_NC) {
+        long nc = n - jc < LMAT_NC ? n - jc : LMAT_NC;
+
+        for (long pc = 0; pc < k; pc += LMAT_KC) {
+            long kc = k - pc < LMAT_KC ? k - pc : LMAT_KC;
+            lmat_pack_b(pb, t->b + pc * n + jc, n, kc, nc);
+
+            for (long ic = t->r0; ic < t->r1; ic += LMAT_MC) {
+                long mc = t->r1 - ic < LMAT_MC ? t->r1 - ic : LMAT_MC;
+                lmat_pack_a(pa, t->a + ic * k + pc, k, mc, kc);
+
+                for (long jr = 0; jr < nc; jr += LMAT_NR) {
+                    for (long ir = 0; ir < mc; ir += LMAT_MR) {
+                        int mr = mc - ir < LMAT_MR ? mc - ir : LMAT_MR;
+                        int nr = nc - jr < LMAT_NR ? nc - jr : LMAT_NR;
+                        lmat_kernel(kc, pa + ir * kc, pb + jr * kc,
+                                    t->c + (ic + ir) * n + jc + jr, n, mr, nr);
+                    }
+                }
+            }
+        }
+    }
+
+    free(pa);
+    free(pb);
+    return NULL;
+}
+
+/* Worker threads for a product of m x n x k, each getting whole tiles of rows */
+static int lmat_threads(long m, long n, long k) {
+    long t = lval_threads > 0 ? lval_threads : sysconf(_SC_NPROCESSORS_ONLN);
+    if (m * n * k < LMAT_PARALLEL || t < 1) { return 1; }
+    if (t > m / LMAT_MR) { t = m / LMAT_MR; }
+    return t > 1 ? (int)t : 1;
+}
+
+static void lmat_multiply(const double* a, const double* b, double* c, long m, long n, long k) {
+
+    memset(c, 0, sizeof(double) * m * n);
+
+    int nt = lmat_threads(m, n, k);
+    lmat_task tasks[nt];
+    long rows = (m / LMAT_MR + nt - 1) / nt * LMAT_MR;
+    for (int i = 0; i < nt; i++) {
+        tasks[i] = (lmat_task){ a, b, c, m, n, k, i * rows, (i + 1) * rows };
+        if (tasks[i].r0 > m) { tasks[i].r0 = m; }
+        if (tasks[i].r1 > m || i == nt - 1) { tasks[i].r1 = m; }
+    }
+
+    if (nt == 1) {
+        lmat_gemm(&tasks[0]);
+        return;
+    }
+
+    // A thread which can't be started runs its rows here instead
+    pthread_t ids[nt];
+    int started[nt];
+    for (int i = 0; i < nt; i++) {
+        started[i] = pthread_create(&ids[i], NULL, lmat_gemm, &tasks[i]) == 0;
+        if (!started[i]) { lmat_gemm(&tasks[i]); }
+    }
+    for (int i = 0; i < nt; i++) {
+        if (started[i]) { pthread_join(ids[i], NULL); }
+    }
+}
+
+/* Inner product of the n elements at x and y */
+static double lmat_dot(const double* x, const double* y, long n) {
+    vreg s0 = vzero(), s1 = vzero();
+    long i = 0;
+    for (; i + 2 * LVEC_WIDTH <= n; i += 2 * LVEC_WIDTH) {
+        s0 = vfma(vload(x + i), vload(y + i), s0);
+        s1 = vfma(vload(x + i + LVEC_WIDTH), vload(y + i + LVEC_WIDTH), s1);
+    }
+    double lanes[LVEC_WIDTH];
+    vstore(lanes, vadd(s0, s1));
+    double r = 0;
+    for (int j = 0; j < LVEC_WIDTH; j++) { r += lanes[j]; }
+    for (; i < n; i++) { r += x[i] * y[i]; }
+    return r;
+}
+
+/*
+** Builtins
+*/
+
+/* Matrix of a list of rows: matrix {{1 2} {3 4}} */
+static lval* span_matrix(lenv* e, lval** x, int n) {
+
+    lval* l = x[0];
+    long cols = 0;
+    for (int i = 0; i < l->count; i++) {
+        lval* row = l->cell[i];
+        if (row->type != LVAL_QEXPR && row->type != LVAL_ARR) {
+            return lval_error("Function 'matrix' passed a row which is not a list");
+        }
+        for (int j = 0; row->type == LVAL_QEXPR && j < row->count; j++) {
+            if (row->cell[j]->type != LVAL_NUM) {
+                return lval_error("Function 'matrix' passed a row containing a non-number");
+            }
+        }
+        if (i > 0 && row->count != cols) {
+            return lval_error("Function 'matrix' passed rows of different lengths");
+        }
+        cols = row->count;
+    }
+
+    lval* m = lval_matrix(l->count, cols);
+    double* p = m->data;
+    for (int i = 0; i < l->count; i++) {
+        lval* row = l->cell[i];
+        if (row->type == LVAL_ARR) {
+            memcpy(p, row->data, sizeof(double) * cols);
+        } else {
+            for (int j = 0; j < cols; j++) { p[j] = row->cell[j]->value; }
+        }
+        p += cols;
+    }
+    return m;
+}
+
+/* Matrix product: matmul a b */
+static lval* span_matmul(lenv* e, lval** x, int n) {
+
+    lval* a = x[0];
+    lval* b = x[1];
+    if (a->cols != b->rows) {
+        return lval_error("Function 'matmul' passed matrices of incompatible shapes");
+    }
+
+    lval* c = lval_matrix(a->rows, b->cols);
+    lmat_multiply(a->data, b->data, c->data, a->rows, b->cols, a->cols);
+    return c;
+}
+
+/* Rows as columns, copied a block at a time so both sides stay in cache */
+static lval* span_transpose(lenv* e, lval** x, int n) {
+
+    lval* m = x[0];
+    long rows = m->rows, cols = m->cols;
+    lval* t = lval_matrix(cols, rows);
+
+    const long block = 32;
+    for (long i0 = 0; i0 < rows; i0 += block) {
+        for (long j0 = 0; j0 < cols; j0 += block) {
+            long i1 = i0 + block < rows ? i0 + block : rows;
+            long j1 = j0 + block < cols ? j0 + block : cols;
+            for (long i = i0; i < i1; i++) {
+                for (long j = j0; j < j1; j++) {
+                    t->data[j * rows + i] = m->data[i * cols + j];
+                }
+            }
+        }
+    }
+    return t;
+}
+
+/* Inner product of two arrays of the same length: dot x y */
+static lval* span_dot(lenv* e, lval** x, int n) {
+    if (x[0]->count != x[1]->count) {
+        return lval_error("Function 'dot' passed arrays of different lengths");
+    }
+    return lval_num(lmat_dot(x[0]->data, x[1]->data, x[0]->count));
+}
+
+/* Rows and columns of a matrix: shape m */
+static lval* span_shape(lenv* e, lval** x, int n) {
+    lval* r = lval_qexpr();
+    lval_add(r, lval_num(x[0]->rows));
+    lval_add(r, lval_num(x[0]->cols));
+    return r;
+}
+
+const lsig sig_matrix = { "matrix", 1, 1, { LARG_QEXPR }, LARG_MAT, NULL, span_matrix };
+const lsig sig_matmul = { "matmul", 2, 2, { LARG_MAT, LARG_MAT }, LARG_MAT, NULL, span_matmul };
+const lsig sig_transpose = { "transpose", 1, 1, { LARG_MAT }, LARG_MAT, NULL, span_transpose };
+const lsig sig_dot = { "dot", 2, 2, { LARG_ARR, LARG_ARR }, LARG_NUM, NULL, span_dot };
+const lsig sig_shape = { "shape", 1, 1, { LARG_MAT }, LARG_QEXPR, NULL, span_shape };
+
+lval* builtin_matrix(lenv* e, lval* a) {
+    return lsig_call(e, &sig_matrix, a);
+}
+
+lval* builtin_matmul(lenv* e, lval* a) {
+    return lsig_call(e, &sig_matmul, a);
+}
+
+lval* builtin_transpose(lenv* e, lval* a) {
+    return lsig_call(e, &sig_transpose, a);
+}
+
+lval* builtin_dot(lenv* e, lval* a) {
+    return lsig_call(e, &sig_dot, a);
+}
+
+lval* builtin_shape(lenv* e, lval* a) {
+    return lsig_call(e, &sig_shape, a);
+}
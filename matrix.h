@@ -0,0 +1,46 @@
+#ifndef MATRIX_H_
+#define MATRIX_H_
+
+#include "lval.h"
+
+/*
+** Dense matrices
+**
+**     matrix {{1 2} {3 4}}    from a list of rows (Q-Expressions or arrays)
+**     matmul a b              matrix product
+**     transpose m
+**     dot x y                 inner product of two arrays
+**     shape m                 {rows columns}
+**
+** A matrix stores its elements as doubles in row-major order, in a buffer
+** like that of an array (see array.h), and + - * / ^ apply to matrices of
+** the same shape element-wise (see vec.h).
+**
+** matmul is blocked for the cache: blocks of b (LMAT_KC x LMAT_NC) and of
+** a (LMAT_MC x LMAT_KC) are packed into contiguous panels, and a kernel
+** keeps an LMAT_MR x LMAT_NR tile of the result in vector registers while
+** it runs down a pair of panels. Products of at least LMAT_PARALLEL
+** multiply-adds split the rows of the result between lval_threads worker
+** threads.
+*/
+#define LMAT_PARALLEL (1L << 21)
+
+/* rows x cols matrix in a new buffer, left uninitialised */
+lval* lval_matrix(long rows, long cols);
+
+/* Matrix of copies of the rows x cols elements at x */
+lval* lval_matrix_of(long rows, long cols, const double* x);
+
+/* Q-Expression of the rows of m (borrowed), each a Q-Expression */
+lval* lmat_to_list(lval* m);
+
+/* Builtins */
+extern const lsig sig_matrix, sig_matmul, sig_transpose, sig_dot, sig_shape;
+
+lval* builtin_matrix(lenv* e, lval* a);
+lval* builtin_matmul(lenv* e, lval* a);
+lval* builtin_transpose(lenv* e, lval* a);
+lval* builtin_dot(lenv* e, lval* a);
+lval* builtin_shape(lenv* e, lval* a);
+
+#endif // MATRIX_H_
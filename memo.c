@@ -0,0 +1,167 @@
+#include "memo.h"
+#include "hcons.h"
+#include <stdlib.h>
+
+#define LVAL_ASSERT(args, cond, err)                \
+    if (!(cond)) { lval_del(args); return lval_error(err); }
+
+lmemo* lmemo_new(int capacity) {
+
+    lmemo* m = calloc(1, sizeof(lmemo));
+    m->refs = 1;
+    m->capacity = capacity;
+
+    // Keep buckets at least twice the capacity
+    m->nbuckets = 16;
+    while (m->nbuckets < 2 * capacity) { m->nbuckets *= 2; }
+    m->buckets = calloc(m->nbuckets, sizeof(lmemo_entry*));
+
+    return m;
+}
+
+lmemo* lmemo_ref(lmemo* m) {
+    m->refs++;
+    return m;
+}
+
+void lmemo_release(lmemo* m) {
+    if (--m->refs > 0) { return; }
+    lmemo_clear(m);
+    free(m->buckets);
+    free(m);
+}
+
+/* Unlink entry from the recency list */
+static void lmemo_unlink(lmemo* m, lmemo_entry* x) {
+    if (x->prev) { x->prev->next = x->next; } else { m->first = x->next; }
+    if (x->next) { x->next->prev = x->prev; } else { m->last = x->prev; }
+    x->prev = x->next = NULL;
+}
+
+/* Make entry the most recently used */
+static void lmemo_push_front(lmemo* m, lmemo_entry* x) {
+    x->next = m->first;
+    if (m->first) { m->first->prev = x; } else { m->last = x; }
+    m->first = x;
+}
+
+static void lmemo_evict(lmemo* m, lmemo_entry* x) {
+
+    lmemo_entry** p = &m->buckets[x->hash & (m->nbuckets - 1)];
+    while (*p != x) { p = &(*p)->chain; }
+    *p = x->chain;
+
+    lmemo_unlink(m, x);
+    lval_del(x->args);
+    lval_del(x->result);
+    free(x);
+    m->size--;
+}
+
+void lmemo_clear(lmemo* m) {
+    while (m->last) { lmemo_evict(m, m->last); }
+}
+
+lval* lmemo_call(lenv* e, lval* f, lval* a) {
+
+    lmemo* m = f->memo;
+    unsigned long h = lval_hash(a);
+
+    for (lmemo_entry* x = m->buckets[h & (m->nbuckets - 1)]; x; x = x->chain) {
+        if (x->hash == h && lval_eq(x->args, a)) {
+            m->hits++;
+            lmemo_unlink(m, x);
+            lmemo_push_front(m, x);
+            lval_del(a);
+            return lval_copy(x->result);
+        }
+    }
+
+    m->misses++;
+
+    // Calls consume their arguments so keep a shared copy as the key
+    lval* key = lval_hcons(lval_copy(a));
+
+    // Call the function itself, without going through this cache again
+    lval* g = lval_copy(f);
+    lmemo_release(g->memo);
+    g->memo = NULL;
+    lval* r = lval_apply(e, g, a);
+
+    // Errors are not cached
+    if (r->type == LVAL_ERROR || m->capacity == 0) {
+        lval_del(key);
+        return r;
+    }
+
+    if (m->size == m->capacity) { lmemo_evict(m, m->last); }
+
+    lmemo_entry* x = calloc(1, sizeof(lmemo_entry));
+    x->hash = h;
+    x->args = key;
+    x->result = lval_hcons(lval_copy(r));
+
+    lmemo_entry** bucket = &m->buckets[h & (m->nbuckets - 1)];
+    x->chain = *bucket;
+    *bucket = x;
+    lmemo_push_front(m, x);
+    m->size++;
+
+    return r;
+}
+
+/*
+** Builtins
+*/
+
+/* Return a memoized copy of a function: memo f [capacity] */
+lval* builtin_memo(lenv* e, lval* a) {
+
+    LVAL_ASSERT(a, a->count == 1 || a->count == 2, "Function 'memo' passed wrong number of arguments");
+    LVAL_ASSERT(a, a->cell[0]->type == LVAL_FUN, "Function 'memo' not a function");
+
+    int capacity = LMEMO_DEFAULT_CAPACITY;
+    if (a->count == 2) {
+        LVAL_ASSERT(a, a->cell[1]->type == LVAL_NUM && a->cell[1]->value >= 0,
+                    "Function 'memo' capacity must be a non-negative number");
+        LVAL_ASSERT(a, a->cell[1]->value <= LMEMO_MAX_CAPACITY,
+                    "Function 'memo' capacity is too large");
+        capacity = a->cell[1]->value;
+    }
+
+    lval* f = lval_take(a, 0);
+    if (f->memo) { lmemo_release(f->memo); }
+    f->memo = lmemo_new(capacity);
+    return f;
+}
+
+/* Return {hits misses size capacity} of a memoized function */
+lval* builtin_memo_stats(lenv* e, lval* a) {
+
+    LVAL_ASSERT(a, a->count == 1, "Function 'memo-stats' passed too many arguments");
+    LVAL_ASSERT(a, a->cell[0]->type == LVAL_FUN && a->cell[0]->memo,
+                "Function 'memo-stats' not a memoized function");
+
+    lmemo* m = a->cell[0]->memo;
+    lval* v = lval_qexpr();
+    lval_add(v, lval_num(m->hits));
+    lval_add(v, lval_num(m->misses));
+    lval_add(v, lval_num(m->size));
+    lval_add(v, lval_num(m->capacity));
+
+    lval_del(a);
+    return v;
+}
+
+/* Drop every cached result of a memoized function */
+lval* builtin_memo_clear(lenv* e, lval* a) {
+
+    LVAL_ASSERT(a, a->count == 1, "Function 'memo-clear' passed too many arguments");
+    LVAL_ASSERT(a, a->cell[0]->type == LVAL_FUN && a->cell[0]->memo,
+                "Function 'memo-clear' not a memoized function");
+
+    lmemo_clear(a->cell[0]->memo);
+
+    lval_del(a);
+    return lval_qexpr();
+}
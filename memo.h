@@ -0,0 +1,52 @@
+#ifndef MEMO_H_
+#define MEMO_H_
+
+#include "lval.h"
+
+#define LMEMO_DEFAULT_CAPACITY 256
+#define LMEMO_MAX_CAPACITY (1 << 20) // Buckets are allocated up front
+
+/*
+** Memoization cache attached to a function value (lval->memo)
+**
+** Results are keyed by the structural hash of the argument list and kept
+** in least recently used order; the oldest entry is evicted once the cache
+** holds capacity entries. Copies of a memoized function share one cache.
+*/
+typedef struct lmemo_entry lmemo_entry;
+
+struct lmemo_entry {
+    unsigned long hash;
+    lval* args;
+    lval* result;
+    lmemo_entry* prev;  // More recently used
+    lmemo_entry* next;  // Less recently used
+    lmemo_entry* chain; // Next entry in the same bucket
+};
+
+struct lmemo {
+    int refs;
+    int capacity;
+    int size;
+    long hits;
+    long misses;
+    int nbuckets;
+    lmemo_entry** buckets;
+    lmemo_entry* first;
+    lmemo_entry* last;
+};
+
+lmemo* lmemo_new(int capacity);
+lmemo* lmemo_ref(lmemo* m);
+void lmemo_release(lmemo* m);
+void lmemo_clear(lmemo* m);
+
+/* Call memoized function f on evaluated arguments a */
+lval* lmemo_call(lenv* e, lval* f, lval* a);
+
+/* Builtins */
+lval* builtin_memo(lenv* e, lval* a);
+lval* builtin_memo_stats(lenv* e, lval* a);
+lval* builtin_memo_clear(lenv* e, lval* a);
+
+#endif // MEMO_H_
@@ -1334,6 +1334,43 @@ int mpc_nparse(const char *filename, const char *string, size_t length, mpc_pars
   return x;
 }
 
+/*
+** Runs p at each position of one input in turn, so that finding every match
+** in a string copies it once rather than once per position. Not part of
+** upstream mpc.
+*/
+int mpc_nsearch(const char *string, size_t length, mpc_parser_t *p, size_t last, mpc_search_t f, void *data) {
+
+  int n = 0;
+  size_t start = 0;
+  mpc_result_t r;
+  mpc_err_t *e;
+  mpc_input_t *i = mpc_input_new_nstring("<mpc_search>", string, length);
+
+  /* Failures only move the search on, so build no error reports */
+  mpc_input_suppress_enable(i);
+
+  while (start <= last && start <= length) {
+    i->state.pos = start;
+    i->last = start ? string[start - 1] : '\0';
+    e = NULL;
+    if (mpc_parse_run(i, p, &r, &e, 0)) {
+      size_t end = i->state.pos;
+      mpc_err_delete_internal(i, e);
+      free(mpc_export(i, r.output));
+      n++;
+      if (!f(start, end, data)) { break; }
+      start = end > start ? end : start + 1;
+    } else {
+      mpc_err_delete_internal(i, mpc_err_merge(i, e, r.error));
+      start++;
+    }
+  }
+
+  mpc_input_delete(i);
+  return n;
+}
+
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r) {
   int x;
   mpc_input_t *i = mpc_input_new_file(filename, file);
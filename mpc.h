@@ -68,6 +68,16 @@ typedef struct mpc_parser_t mpc_parser_t;
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
 int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
+
+/*
+** Searching: p is tried at each position of string from 0 up to last,
+** resuming after the end of each match, and f is called with the span of
+** each match until it returns 0. The output of p is freed with free, as
+** for a regex. Returns the number of matches.
+*/
+typedef int(*mpc_search_t)(size_t start, size_t end, void *data);
+
+int mpc_nsearch(const char *string, size_t length, mpc_parser_t *p, size_t last, mpc_search_t f, void *data);
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
 
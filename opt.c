@@ -0,0 +1,419 @@
+#include "opt.h"
+#include "hcons.h"
+#include "lambda.h"
+#include "iter.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Parameters of the lambdas enclosing the expression being rewritten */
+typedef struct lscope {
+    lval* formals;
+    struct lscope* up;
+} lscope;
+
+static int lscope_has(lscope* s, char* name) {
+    for (; s; s = s->up) {
+        for (int i = 0; i < s->formals->count; i++) {
+            if (strcmp(s->formals->cell[i]->sym, name) == 0) { return 1; }
+        }
+    }
+    return 0;
+}
+
+/* Function bound to head k if it is a global, or NULL */
+static lval* lval_infer_head(lenv* e, lval* k, lscope* scope) {
+
+    if (k->type != LVAL_SYM || lscope_has(scope, k->sym)) { return NULL; }
+
+    lval* f = lenv_get(e, k);
+    if (f->type == LVAL_FUN) { return f; }
+    lval_del(f);
+    return NULL;
+}
+
+/* Parameters q binds if they are all symbols, else NULL */
+static lval* lscope_formals(lval* q) {
+    if (q->type != LVAL_QEXPR) { return NULL; }
+    for (int i = 0; i < q->count; i++) {
+        if (q->cell[i]->type != LVAL_SYM) { return NULL; }
+    }
+    return q;
+}
+
+int lval_fold_enabled = 1;
+
+/* Constants are values that evaluate to themselves */
+static int lval_is_const(lval* v) {
+    return v->type == LVAL_NUM || v->type == LVAL_QEXPR || v->type == LVAL_ARR
+        || v->type == LVAL_MAT || v->type == LVAL_STR;
+}
+
+/* Return the builtin bound to global k if it is pure */
+static lbuiltin lval_pure_head(lenv* e, lval* k, lscope* scope) {
+
+    lval* f = lval_infer_head(e, k, scope);
+    lbuiltin b = f && lbuiltin_is_pure(f->fun) ? f->fun : NULL;
+    if (f) { lval_del(f); }
+    return b;
+}
+
+/*
+** Guarded folds
+**
+** A call folded inside a body becomes (folded {names} {funs} value {call}),
+** with the folded builtin spliced in as a value. When it runs it returns
+** value if every head in names is still bound to the builtin in funs, and
+** evaluates the original call otherwise.
+*/
+static int lval_is_folded(lval* v) {
+    return v->type == LVAL_SEXPR && v->count == 5
+        && v->cell[0]->type == LVAL_FUN && v->cell[0]->fun == builtin_folded;
+}
+
+static void lval_folded_head(lval* names, lval* funs, lval* k, lbuiltin b) {
+    for (int i = 0; i < names->count; i++) {
+        if (strcmp(names->cell[i]->sym, k->sym) == 0) { return; }
+    }
+    lval_add(names, lval_copy(k));
+    lval_add(funs, lval_fun(b));
+}
+
+/* Guarded fold of call t (consumed) with head b to its value r */
+static lval* lval_folded(lval* t, lbuiltin b, lval* r) {
+
+    lval* names = lval_qexpr();
+    lval* funs = lval_qexpr();
+    lval_folded_head(names, funs, t->cell[0], b);
+
+    // Calls folded already are merged back into the original call
+    for (int i = 1; i < t->count; i++) {
+        lval* c = t->cell[i];
+        if (!lval_is_folded(c)) { continue; }
+        for (int j = 0; j < c->cell[1]->count; j++) {
+            lval_folded_head(names, funs, c->cell[1]->cell[j], c->cell[2]->cell[j]->fun);
+        }
+        lval* call = lval_sexpr();
+        for (int j = 0; j < c->cell[4]->count; j++) {
+            lval_add(call, lval_copy(c->cell[4]->cell[j]));
+        }
+        t->cell[i] = call;
+        lval_del(c);
+    }
+
+    lval* call = lval_qexpr();
+    for (int i = 0; i < t->count; i++) { lval_add(call, t->cell[i]); }
+    t->count = 0;
+
+    lval* g = t->type == LVAL_QEXPR ? lval_qexpr() : lval_sexpr();
+    lval* f = lval_fun(builtin_folded);
+    f->sig = &sig_folded;
+    lval_add(g, f);
+    lval_add(g, lval_hcons(names));
+    lval_add(g, funs);
+    lval_add(g, r);
+    lval_add(g, lval_hcons(call));
+
+    lval_del(t);
+    return g;
+}
+
+static lval* lval_fold_expr(lenv* e, lval* t, lscope* scope, int guard, int depth);
+
+/* Fold the bodies of lambdas and loops in call t, guarding each fold */
+static void lval_fold_bodies(lenv* e, lval* t, lscope* scope, int depth) {
+
+    lval* f = t->count >= 3 ? lval_infer_head(e, t->cell[0], scope) : NULL;
+    if (!f) { return; }
+    lbuiltin b = f->fun;
+    lval_del(f);
+
+    // The bodies are the last argument, or both for while
+    lval* formals = NULL;
+    int first = t->count - 1;
+    if (b == builtin_lambda && t->count == 3) {
+        if (!(formals = lscope_formals(t->cell[1]))) { return; }
+    } else if (b == builtin_for_each && t->count == 4) {
+        if (!(formals = lscope_formals(t->cell[1]))) { return; }
+    } else if (b == builtin_while && t->count == 3) {
+        first = 1;
+    } else if (b != builtin_do_times || t->count != 3) {
+        return;
+    }
+
+    lscope inner = { formals, scope };
+    for (int i = first; i < t->count; i++) {
+        if (t->cell[i]->type != LVAL_QEXPR) { continue; }
+        t->cell[i] = lval_hcons(lval_fold_expr(e, t->cell[i], formals ? &inner : scope, 1, depth + 1));
+    }
+}
+
+/* Fold the calls in t (an S-Expression, or a body), innermost first */
+static lval* lval_fold_expr(lenv* e, lval* t, lscope* scope, int guard, int depth) {
+
+    if (depth > LOPT_DEPTH_MAX) { return t; }
+
+    // A shared body is rewritten as a copy and shared again by the caller
+    t = lval_own(t);
+    for (int i = 0; i < t->count; i++) {
+        if (t->cell[i]->type == LVAL_SEXPR) {
+            t->cell[i] = lval_fold_expr(e, t->cell[i], scope, guard, depth + 1);
+        }
+    }
+    lval_fold_bodies(e, t, scope, depth);
+
+    lbuiltin b = t->count >= 2 ? lval_pure_head(e, t->cell[0], scope) : NULL;
+    if (!b) { return t; }
+
+    for (int i = 1; i < t->count; i++) {
+        if (!lval_is_const(t->cell[i]) && !lval_is_folded(t->cell[i])) { return t; }
+    }
+
+    // Errors are left in place so they are reported when evaluated
+    lval* c = lval_copy(t);
+    c->type = LVAL_SEXPR;
+    lval* r = lval_eval(e, c);
+    if (r->type == LVAL_ERROR || (guard && !lval_is_const(r))) {
+        lval_del(r);
+        return t;
+    }
+
+    if (guard) { return lval_folded(t, b, r); }
+    lval_del(t);
+    return r;
+}
+
+lval* lval_fold(lenv* e, lval* t) {
+
+    // Q-Expressions are data; only code is folded
+    if (!lval_fold_enabled || t->type != LVAL_SEXPR) { return t; }
+    return lval_fold_expr(e, t, NULL, 0, 0);
+}
+
+/* Folded call: folded {names} {funs} value {call} */
+static lval* span_folded(lenv* e, lval** x, int n) {
+
+    lval* names = x[0];
+    lval* funs = x[1];
+    for (int i = 0; i < names->count; i++) {
+        lval* f = lenv_get(e, names->cell[i]);
+        int same = f->type == LVAL_FUN && f->fun == funs->cell[i]->fun;
+        lval_del(f);
+        if (!same) { return lval_eval_code(e, x[3]); }
+    }
+
+    lval* v = x[2];
+    x[2] = NULL;
+    return v;
+}
+
+const lsig sig_folded = { "folded", 4, 4, { LARG_QEXPR, LARG_QEXPR, LARG_ANY, LARG_QEXPR }, LARG_ANY, NULL, span_folded };
+
+lval* builtin_folded(lenv* e, lval* a) {
+    return lsig_call(e, &sig_folded, a);
+}
+
+/*
+** Type and arity inference
+**
+** The type of an expression is known when it is a constant or a call to a
+** typed builtin. Symbols are left unknown since globals may be rebound.
+** Calls to typed builtins whose arguments are all known to match are marked
+** with the signature, so the evaluator skips checking them when it finds
+** the same builtin in the head at run time. Calls which can only fail are
+** reported instead.
+*/
+int lval_infer_enabled = 1;
+
+static int lval_infer_expr(lenv* e, lval* t, lscope* scope, lval* errs, int depth);
+
+/* Infer the type of t, returning LARG_ANY if unknown */
+static int lval_infer_type(lenv* e, lval* t, lscope* scope, lval* errs, int depth) {
+    switch(t->type) {
+        case LVAL_NUM: return LARG_NUM;
+        case LVAL_QEXPR: return LARG_QEXPR;
+        case LVAL_ARR: return LARG_ARR;
+        case LVAL_MAT: return LARG_MAT;
+        case LVAL_STR: return LARG_STR;
+        case LVAL_BYTES: return LARG_BYTES;
+        case LVAL_FUN: return LARG_FUN;
+        case LVAL_SEXPR: return lval_infer_expr(e, t, scope, errs, depth);
+    }
+    return LARG_ANY;
+}
+
+/* Infer the type of call t given those of its elements */
+static int lval_infer_call(lenv* e, lval* t, lscope* scope, lval* errs, int depth, int* types) {
+
+    if (t->count == 1) { return types[0]; }
+    if (t->count == 0) { return LARG_ANY; }
+
+    lval* f = lval_infer_head(e, t->cell[0], scope);
+    if (!f) { return LARG_ANY; }
+
+    // The body of a lambda is code run with its parameters in scope
+    if (f->fun == builtin_lambda && t->count == 3
+        && t->cell[1]->type == LVAL_QEXPR && t->cell[2]->type == LVAL_QEXPR) {
+        lval* formals = lscope_formals(t->cell[1]);
+        if (formals) {
+            lscope inner = { formals, scope };
+            lval_infer_expr(e, t->cell[2], &inner, errs, depth + 1);
+        }
+    }
+
+    const lsig* s = f->sig;
+    lval_del(f);
+    if (!s) { return LARG_ANY; }
+
+    int n = t->count - 1;
+    if (n < s->min || (s->max != LSIG_VARIADIC && n > s->max)) {
+        if (errs) { lval_add(errs, lsig_error(s, 0)); }
+        return LARG_ANY;
+    }
+
+    int known = 1;
+    for (int i = 0; i < n; i++) {
+        int match = lsig_type_match(types[i+1], lsig_arg_type(s, i));
+        if (match == 0) { known = 0; }
+        if (match < 0) {
+            if (errs) { lval_add(errs, lsig_error(s, i + 1)); }
+            return LARG_ANY;
+        }
+    }
+
+    // The mark only depends on the structure of t, so shared nodes may carry it
+    if (known) { t->checked = s; }
+
+    // Element-wise builtins return a number when passed only numbers
+    if (s->num && s->span) {
+        int nums = 1;
+        for (int i = 0; i < n; i++) { nums = nums && types[i+1] == LARG_NUM; }
+        if (nums) { return LARG_NUM; }
+    }
+    return s->result;
+}
+
+/* Infer the type of call t, marking it if its checks always pass */
+static int lval_infer_expr(lenv* e, lval* t, lscope* scope, lval* errs, int depth) {
+
+    if (depth > LOPT_DEPTH_MAX) { return LARG_ANY; }
+
+    int* types = malloc(sizeof(int) * (t->count ? t->count : 1));
+    for (int i = 0; i < t->count; i++) {
+        types[i] = lval_infer_type(e, t->cell[i], scope, errs, depth + 1);
+    }
+    int r = lval_infer_call(e, t, scope, errs, depth, types);
+    free(types);
+    return r;
+}
+
+lval* lval_infer(lenv* e, lval* t, lval* errs) {
+
+    if (lval_infer_enabled && t->type == LVAL_SEXPR) {
+        lval_infer_expr(e, t, NULL, errs, 0);
+    }
+    return t;
+}
+
+/*
+** Loop fusion
+**
+** A chain of calls to map, filter and take, optionally ending in a fold,
+** is rewritten to a single call to pipeline (see iter.c), which passes
+** each element through the whole chain without building the intermediate
+** lists. Only heads spelled as the builtin names are fused, since the
+** pipeline looks its stages up again by name when it runs. The pipeline
+** builtin itself is spliced in as a value rather than by name, so the
+** rewrite still runs if the program binds something else to pipeline.
+*/
+int lval_fuse_enabled = 1;
+
+/* Stage of the pipeline call t is, or -1 if it is none */
+static int lval_fuse_stage(lenv* e, lval* t, lscope* scope) {
+
+    if (t->type != LVAL_SEXPR && t->type != LVAL_QEXPR) { return -1; }
+    if (t->count == 0) { return -1; }
+
+    int s = lstage_find(t->cell[0]);
+    if (s < 0 || t->count != lstage_args(s) + 2) { return -1; }
+
+    lval* f = lval_infer_head(e, t->cell[0], scope);
+    int found = f && f->fun == lstage_builtin(s) && !f->memo;
+    if (f) { lval_del(f); }
+    return found ? s : -1;
+}
+
+/* Rewrite t to a pipeline if it heads a chain of at least two stages */
+static lval* lval_fuse_chain(lenv* e, lval* t, lscope* scope) {
+
+    int s = lval_fuse_stage(e, t, scope);
+    if (s < 0) { return t; }
+
+    // Follow the list argument while it is another (non fold) stage
+    int n = 1;
+    lval* v = t->cell[t->count - 1];
+    while (v->type == LVAL_SEXPR) {
+        int k = lval_fuse_stage(e, v, scope);
+        if (k < 0 || k == LSTAGE_FOLD) { break; }
+        v = v->cell[v->count - 1];
+        n++;
+    }
+    if (n < 2) { return t; }
+
+    lval* r = t->type == LVAL_QEXPR ? lval_qexpr() : lval_sexpr();
+    lval* names = lval_qexpr();
+    lval* f = lval_fun(builtin_pipeline);
+    f->sig = &sig_pipeline;
+    lval_add(r, f);
+    lval_add(r, names);
+
+    v = t;
+    for (int i = 0; i < n; i++) {
+        lval_add(names, lval_copy(v->cell[0]));
+        for (int j = 1; j < v->count - 1; j++) {
+            lval_add(r, lval_copy(v->cell[j]));
+        }
+        v = v->cell[v->count - 1];
+    }
+    lval_add(r, lval_copy(v));
+    r->cell[1] = lval_hcons(names);
+
+    lval_del(t);
+    return r;
+}
+
+/* Fuse the calls in t (an S-Expression, or a lambda body), longest chains first */
+static lval* lval_fuse_expr(lenv* e, lval* t, lscope* scope, int depth) {
+
+    if (depth > LOPT_DEPTH_MAX) { return t; }
+
+    // A shared body is rewritten as a copy and shared again below
+    t = lval_fuse_chain(e, lval_own(t), scope);
+    for (int i = 0; i < t->count; i++) {
+        if (t->cell[i]->type == LVAL_SEXPR) {
+            t->cell[i] = lval_fuse_expr(e, t->cell[i], scope, depth + 1);
+        }
+    }
+
+    // The body of a lambda is code run with its parameters in scope
+    if (t->count == 3 && t->cell[1]->type == LVAL_QEXPR && t->cell[2]->type == LVAL_QEXPR) {
+        lval* f = lval_infer_head(e, t->cell[0], scope);
+        int lambda = f && f->fun == builtin_lambda;
+        if (f) { lval_del(f); }
+
+        lval* formals = lscope_formals(t->cell[1]);
+        if (lambda && formals) {
+            lscope inner = { formals, scope };
+            t->cell[2] = lval_hcons(lval_fuse_expr(e, t->cell[2], &inner, depth + 1));
+        }
+    }
+
+    return t;
+}
+
+lval* lval_fuse(lenv* e, lval* t) {
+
+    if (lval_fuse_enabled && t->type == LVAL_SEXPR) {
+        t = lval_fuse_expr(e, t, NULL, 0);
+    }
+    return t;
+}
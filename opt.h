@@ -0,0 +1,56 @@
+#ifndef OPT_H_
+#define OPT_H_
+
+#include "lval.h"
+
+/* The passes recurse in C, so forms nested deeper than this are left as read */
+#define LOPT_DEPTH_MAX 1000
+
+/* Set to 0 to evaluate forms exactly as read (useful when debugging) */
+extern int lval_fold_enabled;
+
+/*
+** Constant folding
+**
+** Run after lval_read and before lval_eval. Replaces s-expressions whose
+** head is a pure builtin and whose arguments are constants with their value.
+**
+** Q-Expressions are data and are not entered, except the bodies of lambdas
+** and loops, which are the code run repeatedly. A body runs against the
+** bindings in force each time it runs, so a call folded there keeps the
+** heads it used and the original call, which runs instead if any of those
+** heads has been rebound since (see builtin_folded).
+*/
+lval* lval_fold(lenv* e, lval* t);
+
+/* Value of a call folded inside a body, while its heads are unchanged */
+extern const lsig sig_folded;
+lval* builtin_folded(lenv* e, lval* a);
+
+/* Set to 0 to run chains of list operations one call at a time */
+extern int lval_fuse_enabled;
+
+/*
+** Loop fusion
+**
+** Run after lval_fold. Rewrites chains of map, filter, take and fold to a
+** single pipeline call which builds no intermediate lists.
+*/
+lval* lval_fuse(lenv* e, lval* t);
+
+/* Set to 0 to check every call to a typed builtin when it is made */
+extern int lval_infer_enabled;
+
+/*
+** Type and arity inference
+**
+** Run after lval_fuse. Marks calls to typed builtins whose arguments always
+** match their signature so the evaluator does not check them again, and
+** adds an error to errs (if not NULL) for each call that always fails.
+**
+** A skipped check is a few comparisons, small next to allocating the
+** arguments, so marked calls have not measured faster than checked ones.
+*/
+lval* lval_infer(lenv* e, lval* t, lval* errs);
+
+#endif // OPT_H_
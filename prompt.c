@@ -8,30 +8,27 @@
 /* Included libraries */
 #include "mpc.h"
 #include "lval.h"
+#include "grammar.h"
+#include "opt.h"
 
 static char input[2048]; // Global input buffer
 
 
 int main(int argc, char** argv) {
 
-        // Define Parsers
-        mpc_parser_t* Number = mpc_new("number");
-        mpc_parser_t* Symbol = mpc_new("symbol");
-        mpc_parser_t* Sexpression = mpc_new("sexpression");
-        mpc_parser_t* Qexpression = mpc_new("qexpression");
-        mpc_parser_t* Expression = mpc_new("expression");
-        mpc_parser_t* Lisps = mpc_new("lisps"); // Overall rule for Lisp line
-
-        // Define Grammar
-        mpca_lang(MPCA_LANG_DEFAULT, " \
-number: /-?[0-9]+(\\.[0-9]+)?/ ; \
-symbol: '+' | '-' | '*' | '/' | '^' | \"list\" | \"head\" | \"tail\" | \"join\" | \"eval\" | \"len\" | \"init\" ; \
-sexpression: '(' <expression>* ')' ; \
-qexpression: '{' <expression>* '}' ; \
-expression: <number> | <symbol> | <sexpression> | <qexpression> ; \
-lisps: /^/ <expression>* /$/ ; \
-        ",
-        Number, Symbol, Sexpression, Qexpression, Expression, Lisps);
+    // Pass --no-fold to evaluate input exactly as typed, --no-fuse to run
+    // list operations one call at a time, --no-infer to check every
+    // builtin call when it is made and --threads N to limit parallel
+    // builtins to N threads
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-fold") == 0) { lval_fold_enabled = 0; }
+        if (strcmp(argv[i], "--no-fuse") == 0) { lval_fuse_enabled = 0; }
+        if (strcmp(argv[i], "--no-infer") == 0) { lval_infer_enabled = 0; }
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) { lval_threads = atoi(argv[++i]); }
+    }
+
+    // Define Parsers and Grammar
+    mpc_parser_t* Lisps = grammar_new();
 
     puts("Joash's Lisp (Jispy) Version 0.0.1");
     puts("Press Ctrl-C to exit");
@@ -45,16 +42,17 @@ lisps: /^/ <expression>* /$/ ; \
         add_history(input);
 
         // Parse and evaluate input
-        mpc_result_t* r;
-        if (mpc_parse("<stdin>", input, Lisps, r)) {
-            lval* input_lval = lval_eval(e, lval_read(r->output));
+        mpc_result_t r;
+        if (mpc_parse("<stdin>", input, Lisps, &r)) {
+            lval* x = lval_fuse(e, lval_fold(e, lval_resolve(lval_read(r.output))));
+            lval* input_lval = lval_eval(e, lval_infer(e, x, NULL));
             lval_println(input_lval);
             lval_del(input_lval);
-            mpc_ast_delete(r->output);
+            mpc_ast_delete(r.output);
 
         } else {
-            mpc_err_print(r->error);
-            mpc_err_delete(r->error);
+            mpc_err_print(r.error);
+            mpc_err_delete(r.error);
         }
 
         free(input);
@@ -63,7 +61,7 @@ lisps: /^/ <expression>* /$/ ; \
 
     lenv_del(e);
 
-    mpc_cleanup(6, Number, Symbol, Sexpression, Qexpression, Expression, Lisps);
+    grammar_cleanup();
 
     return 0;
 
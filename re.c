@@ -0,0 +1,255 @@
+#include "re.h"
+#include "hcons.h"
+#include "str.h"
+#include "mpc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+** Cache of compiled patterns
+**
+** Entries are chained in buckets by the hash of their pattern and kept in
+** least recently used order, as in memo.c.
+*/
+#define LRE_BUCKETS (2 * LRE_CACHE_CAPACITY)
+
+typedef struct lre_entry lre_entry;
+
+struct lre_entry {
+    unsigned long hash;
+    lval* pat;
+    mpc_parser_t* re;
+    lre_entry* prev;  // More recently used
+    lre_entry* next;  // Less recently used
+    lre_entry* chain; // Next entry in the same bucket
+};
+
+static struct {
+    long hits;
+    long misses;
+    int size;
+    lre_entry* buckets[LRE_BUCKETS];
+    lre_entry* first;
+    lre_entry* last;
+} lre_cache;
+
+/* Unlink entry from the recency list */
+static void lre_unlink(lre_entry* x) {
+    if (x->prev) { x->prev->next = x->next; } else { lre_cache.first = x->next; }
+    if (x->next) { x->next->prev = x->prev; } else { lre_cache.last = x->prev; }
+    x->prev = x->next = NULL;
+}
+
+/* Make entry the most recently used */
+static void lre_push_front(lre_entry* x) {
+    x->next = lre_cache.first;
+    if (lre_cache.first) { lre_cache.first->prev = x; } else { lre_cache.last = x; }
+    lre_cache.first = x;
+}
+
+static void lre_evict(lre_entry* x) {
+
+    lre_entry** p = &lre_cache.buckets[x->hash & (LRE_BUCKETS - 1)];
+    while (*p != x) { p = &(*p)->chain; }
+    *p = x->chain;
+
+    lre_unlink(x);
+    lval_del(x->pat);
+    mpc_delete(x->re);
+    free(x);
+    lre_cache.size--;
+}
+
+/* Whether re is a real pattern, rather than the parser mpc_re makes to
+** report a syntax error, which fails everywhere with "Invalid Regex" */
+static int lre_valid(mpc_parser_t* re) {
+    mpc_result_t r;
+    if (mpc_parse("<re>", "", re, &r)) {
+        free(r.output);
+        return 1;
+    }
+    int valid = !r.error->failure || strncmp(r.error->failure, "Invalid Regex", 13) != 0;
+    mpc_err_delete(r.error);
+    return valid;
+}
+
+/* Compiled parser of a pattern (owned by the cache), or NULL if invalid */
+static mpc_parser_t* lre_compile(lval* pat) {
+
+    unsigned long h = lval_hash(pat);
+
+    for (lre_entry* x = lre_cache.buckets[h & (LRE_BUCKETS - 1)]; x; x = x->chain) {
+        if (x->hash == h && lval_eq(x->pat, pat)) {
+            lre_cache.hits++;
+            lre_unlink(x);
+            lre_push_front(x);
+            return x->re;
+        }
+    }
+
+    lre_cache.misses++;
+
+    char* src = malloc(pat->count + 1);
+    memcpy(src, lval_str_bytes(pat), pat->count);
+    src[pat->count] = '\0';
+    mpc_parser_t* re = mpc_re(src);
+    free(src);
+
+    // Invalid patterns are not cached
+    if (!lre_valid(re)) {
+        mpc_delete(re);
+        return NULL;
+    }
+
+    if (lre_cache.size == LRE_CACHE_CAPACITY) { lre_evict(lre_cache.last); }
+
+    lre_entry* x = calloc(1, sizeof(lre_entry));
+    x->hash = h;
+    x->pat = lval_hcons(lval_copy(pat));
+    x->re = re;
+
+    lre_entry** bucket = &lre_cache.buckets[h & (LRE_BUCKETS - 1)];
+    x->chain = *bucket;
+    *bucket = x;
+    lre_push_front(x);
+    lre_cache.size++;
+
+    return re;
+}
+
+static lval* lre_error(const lsig* s) {
+    char err[128];
+    snprintf(err, sizeof(err), "Function '%s' passed an invalid pattern", s->name);
+    return lval_error(err);
+}
+
+/*
+** Collecting matches
+*/
+
+/* End of the first match */
+static int lre_on_first(size_t start, size_t end, void* data) {
+    *(size_t*)data = end;
+    return 0;
+}
+
+typedef struct {
+    lval* s;
+    lval* out;
+    int cap;
+} lre_found;
+
+static int lre_on_found(size_t start, size_t end, void* data) {
+    lre_found* f = data;
+    if (f->out->count == f->cap) {
+        f->cap *= 2;
+        f->out->cell = realloc(f->out->cell, sizeof(lval*) * f->cap);
+    }
+    f->out->cell[f->out->count++] = lval_str_view(f->s, start, end - start);
+    return 1;
+}
+
+typedef struct {
+    const char* h;     // Text searched
+    const char* with;  // Replacement
+    long nwith;
+    char* out;
+    long used;
+    long cap;
+    long prev;         // End of the last match
+} lre_replaced;
+
+/* Append the n bytes at b to the output */
+static void lre_append(lre_replaced* r, const char* b, long n) {
+    if (n == 0) { return; }
+    if (r->used + n > r->cap) {
+        r->cap = (r->used + n) * 2;
+        r->out = realloc(r->out, r->cap);
+    }
+    memcpy(r->out + r->used, b, n);
+    r->used += n;
+}
+
+static int lre_on_replaced(size_t start, size_t end, void* data) {
+    lre_replaced* r = data;
+    lre_append(r, r->h + r->prev, start - r->prev);
+    lre_append(r, r->with, r->nwith);
+    r->prev = end;
+    return 1;
+}
+
+/*
+** Builtins
+*/
+
+/* Whether a pattern matches a whole string: re-match "2024" "[0-9]+" */
+static lval* span_re_match(lenv* e, lval** x, int n) {
+
+    mpc_parser_t* re = lre_compile(x[1]);
+    if (!re) { return lre_error(&sig_re_match); }
+
+    size_t end = 0;
+    int found = mpc_nsearch(lval_str_bytes(x[0]), x[0]->count, re, 0, lre_on_first, &end);
+    return lval_num(found && end == (size_t)x[0]->count);
+}
+
+/* Every match of a pattern: re-find-all "a1b22" "[0-9]+" */
+static lval* span_re_find_all(lenv* e, lval** x, int n) {
+
+    mpc_parser_t* re = lre_compile(x[1]);
+    if (!re) { return lre_error(&sig_re_find_all); }
+
+    lre_found f = { x[0], lval_qexpr(), 16 };
+    f.out->cell = malloc(sizeof(lval*) * f.cap);
+    mpc_nsearch(lval_str_bytes(x[0]), x[0]->count, re, x[0]->count, lre_on_found, &f);
+    return f.out;
+}
+
+/* Every match of a pattern replaced: re-replace "a1b22" "[0-9]+" "#" */
+static lval* span_re_replace(lenv* e, lval** x, int n) {
+
+    mpc_parser_t* re = lre_compile(x[1]);
+    if (!re) { return lre_error(&sig_re_replace); }
+
+    lval* s = x[0];
+    lre_replaced r = { lval_str_bytes(s), lval_str_bytes(x[2]), x[2]->count, NULL, 0, 0, 0 };
+    if (!mpc_nsearch(r.h, s->count, re, s->count, lre_on_replaced, &r)) {
+        x[0] = NULL;
+        return s;
+    }
+    lre_append(&r, r.h + r.prev, s->count - r.prev);
+    if (!r.out) { return lval_str("", 0); }
+    return lval_str_own(r.out, r.used);
+}
+
+/* Return {hits misses size capacity} of the pattern cache: re-stats {} */
+static lval* span_re_stats(lenv* e, lval** x, int n) {
+    lval* v = lval_qexpr();
+    lval_add(v, lval_num(lre_cache.hits));
+    lval_add(v, lval_num(lre_cache.misses));
+    lval_add(v, lval_num(lre_cache.size));
+    lval_add(v, lval_num(LRE_CACHE_CAPACITY));
+    return v;
+}
+
+const lsig sig_re_match = { "re-match", 2, 2, { LARG_STR, LARG_STR }, LARG_NUM, NULL, span_re_match };
+const lsig sig_re_find_all = { "re-find-all", 2, 2, { LARG_STR, LARG_STR }, LARG_QEXPR, NULL, span_re_find_all };
+const lsig sig_re_replace = { "re-replace", 3, 3, { LARG_STR, LARG_STR, LARG_STR }, LARG_STR, NULL, span_re_replace };
+const lsig sig_re_stats = { "re-stats", 1, 1, { LARG_QEXPR }, LARG_QEXPR, NULL, span_re_stats };
+
+lval* builtin_re_match(lenv* e, lval* a) {
+    return lsig_call(e, &sig_re_match, a);
+}
+
+lval* builtin_re_find_all(lenv* e, lval* a) {
+    return lsig_call(e, &sig_re_find_all, a);
+}
+
+lval* builtin_re_replace(lenv* e, lval* a) {
+    return lsig_call(e, &sig_re_replace, a);
+}
+
+lval* builtin_re_stats(lenv* e, lval* a) {
+    return lsig_call(e, &sig_re_stats, a);
+}
@@ -0,0 +1,36 @@
+#ifndef RE_H_
+#define RE_H_
+
+#include "lval.h"
+
+/*
+** Regular expressions
+**
+**     re-match s pat          1 if pat matches the whole of s, otherwise 0
+**     re-find-all s pat       Q-Expression of every match of pat in s
+**     re-replace s pat new    s with every match of pat replaced by new
+**     re-stats {}             {hits misses size capacity} of the cache
+**
+** Patterns have the syntax of the regexes in the grammar (mpc_re) and match
+** the way mpc parses: at the leftmost position, with greedy repetition that
+** never gives characters back, so "a*a" matches nothing. Matches do not
+** overlap, and those returned by re-find-all are views of s (see str.h).
+** A pattern that does not parse as a regex is an error; note that an
+** unbalanced '(' or '[' is read as a literal character.
+**
+** Compiling a pattern builds a parser, which costs far more than matching
+** a short string with it, so compiled patterns are cached, keyed by the
+** pattern string. The least recently used is dropped once the cache holds
+** LRE_CACHE_CAPACITY patterns.
+*/
+#define LRE_CACHE_CAPACITY 64
+
+/* Builtins */
+extern const lsig sig_re_match, sig_re_find_all, sig_re_replace, sig_re_stats;
+
+lval* builtin_re_match(lenv* e, lval* a);
+lval* builtin_re_find_all(lenv* e, lval* a);
+lval* builtin_re_replace(lenv* e, lval* a);
+lval* builtin_re_stats(lenv* e, lval* a);
+
+#endif // RE_H_
@@ -0,0 +1,151 @@
+#include "record.h"
+#include "hcons.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LVAL_ASSERT(args, cond, err)                \
+    if (!(cond)) { lval_del(args); return lval_error(err); }
+
+static char* lrec_strdup(char* s) {
+    char* c = malloc(strlen(s) + 1);
+    strcpy(c, s);
+    return c;
+}
+
+void lrec_release(lrec* r) {
+
+    if (--r->refs > 0) { return; }
+
+    for (int i = 0; i < r->nfields; i++) { free(r->fields[i]); }
+    free(r->fields);
+    free(r->name);
+    free(r);
+}
+
+/* Function value of kind field over record type r */
+static lval* lrec_fun(lrec* r, int field) {
+    lval* f = lval_fun(NULL);
+    f->rec = r;
+    f->field = field;
+    r->refs++;
+    return f;
+}
+
+/* Bind name (plus suffix) to f in the global environment; consumes f */
+static void lrec_define(lenv* e, char* name, char* suffix, lval* f) {
+    char* s = malloc(strlen(name) + strlen(suffix) + 1);
+    strcpy(s, name);
+    strcat(s, suffix);
+
+    lval* k = lval_sym(s);
+    lenv_put(e, k, f);
+    lval_del(k);
+    lval_del(f);
+    free(s);
+}
+
+/* Error from record function f, named as it was defined */
+static lval* lrec_error(lval* f, char* problem) {
+    lrec* r = f->rec;
+    char err[128];
+    snprintf(err, sizeof(err), "Function '%s%s%s' %s", r->name,
+        f->field == LREC_NEW ? "" : f->field == LREC_IS ? "?" : "-",
+        f->field >= 0 ? r->fields[f->field] : "", problem);
+    return lval_error(err);
+}
+
+lval* lrec_call(lenv* e, lval* f, lval* a) {
+
+    lrec* r = f->rec;
+
+    // The arguments become the fields of the new instance in place. Records
+    // are immutable, so the instance is shared like a literal and copying
+    // it (e.g. looking it up by name) only takes another reference
+    if (f->field == LREC_NEW) {
+        if (a->count != r->nfields) {
+            lval_del(a);
+            return lrec_error(f, "passed wrong number of arguments");
+        }
+        a->type = LVAL_REC;
+        a->checked = NULL;
+        a->rec = r;
+        r->refs++;
+        return lval_hcons(a);
+    }
+
+    if (a->count != 1) {
+        lval_del(a);
+        return lrec_error(f, "passed wrong number of arguments");
+    }
+
+    lval* x = a->cell[0];
+    int is = x->type == LVAL_REC && x->rec == r;
+
+    if (f->field == LREC_IS) {
+        lval_del(a);
+        return lval_num(is);
+    }
+
+    if (!is) {
+        lval_del(a);
+        return lrec_error(f, "passed a value of another type");
+    }
+
+    // Move the field out of an instance nothing else refers to (one that
+    // holds a function, say, which can't be shared)
+    lval* v;
+    if (x->refs > 0) {
+        v = lval_copy(x->cell[f->field]);
+    } else {
+        v = x->cell[f->field];
+        x->cell[f->field] = lval_sexpr();
+    }
+    lval_del(a);
+    return v;
+}
+
+/*
+** Builtins
+*/
+
+/* Define a record type: record {name} {fields} */
+lval* builtin_record(lenv* e, lval* a) {
+
+    LVAL_ASSERT(a, a->count == 2, "Function 'record' passed wrong number of arguments");
+    LVAL_ASSERT(a, a->cell[0]->type == LVAL_QEXPR && a->cell[0]->count == 1
+        && a->cell[0]->cell[0]->type == LVAL_SYM, "Function 'record' name not a single symbol");
+    LVAL_ASSERT(a, a->cell[1]->type == LVAL_QEXPR, "Function 'record' fields not a Q-Expression");
+
+    lval* fields = a->cell[1];
+    for (int i = 0; i < fields->count; i++) {
+        LVAL_ASSERT(a, fields->cell[i]->type == LVAL_SYM, "Function 'record' cannot define non-symbol field");
+        for (int j = 0; j < i; j++) {
+            LVAL_ASSERT(a, strcmp(fields->cell[i]->sym, fields->cell[j]->sym) != 0,
+                "Function 'record' passed a field twice");
+        }
+    }
+
+    lrec* r = calloc(1, sizeof(lrec));
+    r->refs = 1;
+    r->name = lrec_strdup(a->cell[0]->cell[0]->sym);
+    r->nfields = fields->count;
+    r->fields = malloc(sizeof(char*) * fields->count);
+    for (int i = 0; i < fields->count; i++) {
+        r->fields[i] = lrec_strdup(fields->cell[i]->sym);
+    }
+
+    lrec_define(e, r->name, "", lrec_fun(r, LREC_NEW));
+    lrec_define(e, r->name, "?", lrec_fun(r, LREC_IS));
+    for (int i = 0; i < r->nfields; i++) {
+        char* suffix = malloc(strlen(r->fields[i]) + 2);
+        strcpy(suffix, "-");
+        strcat(suffix, r->fields[i]);
+        lrec_define(e, r->name, suffix, lrec_fun(r, i));
+        free(suffix);
+    }
+
+    lrec_release(r);
+    lval_del(a);
+    return lval_sexpr();
+}
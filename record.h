@@ -0,0 +1,36 @@
+#ifndef RECORD_H_
+#define RECORD_H_
+
+#include "lval.h"
+
+/*
+** Record types
+**
+**     record {point} {x y}
+**
+** defines a constructor (point 1 2), a predicate (point? p) and an accessor
+** for each field (point-x p). An instance holds its fields in order in its
+** cell array, and each accessor is a function value carrying the record
+** type and the position of its field, so reading a field is a single
+** indexed load with no search by name and no list traversal.
+*/
+struct lrec {
+    int refs;
+    char* name;
+    int nfields;
+    char** fields;
+};
+
+/* Record function kinds in lval->field besides the index of a field */
+#define LREC_NEW -1 // Constructor
+#define LREC_IS -2  // Predicate
+
+void lrec_release(lrec* r);
+
+/* Call constructor, predicate or accessor f on arguments a */
+lval* lrec_call(lenv* e, lval* f, lval* a);
+
+/* Builtins */
+lval* builtin_record(lenv* e, lval* a);
+
+#endif // RECORD_H_
@@ -0,0 +1,202 @@
+#include "rel.h"
+#include "iter.h"
+#include "map.h"
+#include "seq.h"
+#include <stdlib.h>
+
+/* List x[i], collected first if it is a sequence; x[i] is taken */
+static lval* rel_list(lenv* e, lval** x, int i) {
+    lval* l = x[i]->type == LVAL_SEQ ? lseq_collect(e, x[i]) : x[i];
+    if (l == x[i]) { x[i] = NULL; }
+    return l;
+}
+
+/* Key of element v (borrowed) under f */
+static lval* rel_key(lenv* e, lval* f, lval* v) {
+    return lval_apply(e, lval_copy(f), lval_add(lval_sexpr(), lval_copy(v)));
+}
+
+/*
+** Index of the entry for key k in out, adding {k {}} (or {k 0} to count)
+** if it is new. index maps each key to its position in out, held in the
+** count of the value rather than as a number, which as a float would only
+** be exact up to 2^24. Consumes k.
+*/
+static int rel_entry(lmap* index, lval* out, lval* k, int count) {
+
+    lval* i = lmap_get(index, k);
+    if (i) {
+        lval_del(k);
+        return i->count;
+    }
+
+    lval* pos = lval_num(0);
+    pos->count = out->count;
+    lmap_put(index, lval_copy(k), pos);
+    lval_add(out, lval_add(lval_add(lval_qexpr(), k), count ? lval_num(0) : lval_qexpr()));
+    return out->count - 1;
+}
+
+/* Group elements by key: group-by f xs */
+static lval* span_group_by(lenv* e, lval** x, int n) {
+
+    lval* l = rel_list(e, x, 1);
+    if (l->type == LVAL_ERROR) { return l; }
+
+    lmap* index = lmap_new(0);
+    lval* out = lval_qexpr();
+
+    for (int i = 0; i < l->count; i++) {
+        lval* k = rel_key(e, x[0], l->cell[i]);
+        if (k->type == LVAL_ERROR) {
+            lmap_release(index);
+            lval_del(out);
+            iter_free(l);
+            return k;
+        }
+        int g = rel_entry(index, out, k, 0);
+        lval_add(out->cell[g]->cell[1], iter_take(l, i));
+    }
+
+    lmap_release(index);
+    iter_free(l);
+    return out;
+}
+
+/* Count elements by key: count-by f xs */
+static lval* span_count_by(lenv* e, lval** x, int n) {
+
+    lval* l = rel_list(e, x, 1);
+    if (l->type == LVAL_ERROR) { return l; }
+
+    lmap* index = lmap_new(0);
+    lval* out = lval_qexpr();
+
+    // Counted as integers, since a float stops counting at 2^24
+    int cap = 16;
+    long* counts = malloc(sizeof(long) * cap);
+
+    for (int i = 0; i < l->count; i++) {
+        lval* k = rel_key(e, x[0], l->cell[i]);
+        if (k->type == LVAL_ERROR) {
+            lmap_release(index);
+            lval_del(out);
+            lval_del(l);
+            free(counts);
+            return k;
+        }
+        int groups = out->count;
+        int g = rel_entry(index, out, k, 1);
+        if (out->count > groups) {
+            if (g == cap) {
+                cap *= 2;
+                counts = realloc(counts, sizeof(long) * cap);
+            }
+            counts[g] = 0;
+        }
+        counts[g]++;
+    }
+
+    for (int g = 0; g < out->count; g++) { out->cell[g]->cell[1]->value = counts[g]; }
+
+    free(counts);
+    lmap_release(index);
+    lval_del(l);
+    return out;
+}
+
+/* Drop repeated elements, keeping the first of each: distinct xs */
+static lval* span_distinct(lenv* e, lval** x, int n) {
+
+    lval* l = rel_list(e, x, 0);
+    if (l->type == LVAL_ERROR) { return l; }
+
+    lmap* seen = lmap_new(1);
+    lval* out = lval_qexpr();
+    out->cell = malloc(sizeof(lval*) * (l->count ? l->count : 1));
+
+    for (int i = 0; i < l->count; i++) {
+        if (lmap_get(seen, l->cell[i])) { continue; }
+        lmap_put(seen, lval_copy(l->cell[i]), NULL);
+        out->cell[out->count++] = iter_take(l, i);
+    }
+
+    lmap_release(seen);
+    iter_free(l);
+    out->cell = realloc(out->cell, sizeof(lval*) * (out->count ? out->count : 1));
+    return out;
+}
+
+/* Pair every x with every y of the same key: hash-join f xs g ys */
+static lval* span_hash_join(lenv* e, lval** x, int n) {
+
+    lval* xs = rel_list(e, x, 1);
+    if (xs->type == LVAL_ERROR) { return xs; }
+    lval* ys = rel_list(e, x, 3);
+    if (ys->type == LVAL_ERROR) {
+        lval_del(xs);
+        return ys;
+    }
+
+    // Build: the elements of ys grouped by key
+    lmap* index = lmap_new(0);
+    lval* groups = lval_qexpr();
+    lval* err = NULL;
+
+    for (int i = 0; i < ys->count && !err; i++) {
+        lval* k = rel_key(e, x[2], ys->cell[i]);
+        if (k->type == LVAL_ERROR) { err = k; break; }
+        int g = rel_entry(index, groups, k, 0);
+        lval_add(groups->cell[g]->cell[1], iter_take(ys, i));
+    }
+
+    // Probe: each x against the group of its key
+    lval* out = lval_qexpr();
+    for (int i = 0; i < xs->count && !err; i++) {
+        lval* k = rel_key(e, x[0], xs->cell[i]);
+        if (k->type == LVAL_ERROR) { err = k; break; }
+
+        lval* g = lmap_get(index, k);
+        lval_del(k);
+        if (!g) { continue; }
+
+        lval* match = groups->cell[g->count]->cell[1];
+        for (int j = 0; j < match->count; j++) {
+            lval* pair = lval_qexpr();
+            lval_add(pair, lval_copy(xs->cell[i]));
+            lval_add(pair, lval_copy(match->cell[j]));
+            lval_add(out, pair);
+        }
+    }
+
+    lmap_release(index);
+    lval_del(groups);
+    iter_free(ys);
+    lval_del(xs);
+    if (err) {
+        lval_del(out);
+        return err;
+    }
+    return out;
+}
+
+const lsig sig_group_by = { "group-by", 2, 2, { LARG_FUN, LARG_LIST }, LARG_QEXPR, NULL, span_group_by };
+const lsig sig_count_by = { "count-by", 2, 2, { LARG_FUN, LARG_LIST }, LARG_QEXPR, NULL, span_count_by };
+const lsig sig_distinct = { "distinct", 1, 1, { LARG_LIST }, LARG_QEXPR, NULL, span_distinct };
+const lsig sig_hash_join = { "hash-join", 4, 4, { LARG_FUN, LARG_LIST, LARG_FUN, LARG_LIST }, LARG_QEXPR, NULL, span_hash_join };
+
+lval* builtin_group_by(lenv* e, lval* a) {
+    return lsig_call(e, &sig_group_by, a);
+}
+
+lval* builtin_count_by(lenv* e, lval* a) {
+    return lsig_call(e, &sig_count_by, a);
+}
+
+lval* builtin_distinct(lenv* e, lval* a) {
+    return lsig_call(e, &sig_distinct, a);
+}
+
+lval* builtin_hash_join(lenv* e, lval* a) {
+    return lsig_call(e, &sig_hash_join, a);
+}
@@ -0,0 +1,27 @@
+#ifndef REL_H_
+#define REL_H_
+
+#include "lval.h"
+
+/*
+** Relational builtins over lists
+**
+**     group-by f xs          {{k {x ...}} ...}
+**     count-by f xs          {{k n} ...}
+**     distinct xs            {x ...}
+**     hash-join f xs g ys    {{x y} ...} for every f x equal to g y
+**
+** Each makes a single pass over its lists with a temporary hash table
+** (see map.c) keyed by the structural value of the key, so the work is
+** linear rather than a scan per element. Groups, counts and distinct
+** elements come out in the order their key first appears; join results
+** follow the order of xs, then ys.
+*/
+extern const lsig sig_group_by, sig_count_by, sig_distinct, sig_hash_join;
+
+lval* builtin_group_by(lenv* e, lval* a);
+lval* builtin_count_by(lenv* e, lval* a);
+lval* builtin_distinct(lenv* e, lval* a);
+lval* builtin_hash_join(lenv* e, lval* a);
+
+#endif // REL_H_
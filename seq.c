@@ -0,0 +1,342 @@
+#include "seq.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <math.h>
+
+static lseq* lseq_new(int kind, lseq* src) {
+    lseq* s = calloc(1, sizeof(lseq));
+    s->refs = 1;
+    s->kind = kind;
+    s->src = src;
+    if (src) { src->refs++; }
+    return s;
+}
+
+lval* lval_seq(lseq* s) {
+    lval* v = calloc(1, sizeof(lval));
+    v->type = LVAL_SEQ;
+    v->seq = s;
+    return v;
+}
+
+void lseq_release(lseq* s) {
+    while (s && --s->refs == 0) {
+        lseq* src = s->src;
+        if (s->f) { lval_del(s->f); }
+        free(s);
+        s = src;
+    }
+}
+
+/*
+** Iteration
+**
+** An iterator holds the chain of recipes as an array, from the sequence
+** iterated down to the range it draws from, with how far each one has
+** got. Each element is pulled through the whole chain before the next:
+** down through the stages to the range, and back up with the element,
+** until it is returned or a filter or drop discards it and pulls again.
+** The chain may be arbitrarily long, so this is a loop, not recursion.
+*/
+typedef struct {
+    lseq* s;
+    long i; // Elements produced by a range, or taken or dropped
+} lseq_stage;
+
+struct lseq_iter {
+    int count;
+    lseq_stage* stages;
+};
+
+lseq_iter* lseq_iter_new(lseq* s) {
+
+    lseq_iter* it = calloc(1, sizeof(lseq_iter));
+    for (lseq* t = s; t; t = t->src) { it->count++; }
+
+    it->stages = calloc(it->count, sizeof(lseq_stage));
+    for (int k = 0; k < it->count; k++, s = s->src) { it->stages[k].s = s; }
+    return it;
+}
+
+void lseq_iter_del(lseq_iter* it) {
+    free(it->stages);
+    free(it);
+}
+
+/* Pass *v up through stage t; returns 0 if t discarded it (deleting it) and needs another */
+static int lseq_pass(lenv* e, lseq_stage* t, lval** v) {
+
+    lseq* s = t->s;
+
+    switch (s->kind) {
+
+        case LSEQ_MAP:
+            if ((*v)->type != LVAL_ERROR) {
+                *v = lval_apply(e, lval_copy(s->f), lval_add(lval_sexpr(), *v));
+            }
+            return 1;
+
+        case LSEQ_FILTER: {
+            if ((*v)->type == LVAL_ERROR) { return 1; }
+
+            lval* r = lval_apply(e, lval_copy(s->f), lval_add(lval_sexpr(), lval_copy(*v)));
+            if (r->type != LVAL_NUM) {
+                lval_del(*v);
+                *v = r->type == LVAL_ERROR ? r
+                    : lval_error("Function 'filter' predicate did not return a number");
+                if (*v != r) { lval_del(r); }
+                return 1;
+            }
+
+            int keep = r->value != 0;
+            lval_del(r);
+            if (!keep) { lval_del(*v); }
+            return keep;
+        }
+
+        case LSEQ_DROP:
+            if (t->i >= s->n) { return 1; }
+            t->i++;
+            if ((*v)->type == LVAL_ERROR) { return 1; }
+            lval_del(*v);
+            return 0;
+    }
+
+    return 1;
+}
+
+int lseq_next(lenv* e, lseq_iter* it, lval** v) {
+
+    int k = 0;
+    while (1) {
+
+        // Down to the range, counting the element against each take on the way
+        for (; it->stages[k].s->kind != LSEQ_RANGE; k++) {
+            lseq_stage* t = &it->stages[k];
+            if (t->s->kind == LSEQ_TAKE) {
+                if (t->i >= t->s->n) { return 0; }
+                t->i++;
+            }
+        }
+
+        lseq_stage* r = &it->stages[k];
+        if (r->i >= r->s->n) { return 0; }
+        *v = lval_num(r->s->start + r->s->step * r->i++);
+
+        // Back up, until it is returned or a stage discards it and pulls again
+        for (k--; k >= 0; k--) {
+            if (!lseq_pass(e, &it->stages[k], v)) { break; }
+        }
+        if (k < 0) { return 1; }
+        k++;
+    }
+}
+
+/* Number of elements of s if known without pulling them, or -1 */
+static long lseq_count(lseq* s) {
+
+    // From the range at the bottom of the chain up
+    lseq_iter* it = lseq_iter_new(s);
+    long n = 0;
+    for (int k = it->count - 1; k >= 0 && n >= 0; k--) {
+        lseq* t = it->stages[k].s;
+        switch (t->kind) {
+            case LSEQ_RANGE: n = t->n; break;
+            case LSEQ_MAP: break;
+            case LSEQ_FILTER: n = -1; break;
+            case LSEQ_TAKE: n = n < t->n ? n : t->n; break;
+            case LSEQ_DROP: n = n > t->n ? n - t->n : 0; break;
+        }
+    }
+    lseq_iter_del(it);
+    return n;
+}
+
+/*
+** Operations
+*/
+
+/* First element in a list, like head of a Q-Expression */
+lval* lseq_head(lenv* e, lval* s) {
+
+    lseq_iter* it = lseq_iter_new(s->seq);
+    lval* v = NULL;
+    int found = lseq_next(e, it, &v);
+    lseq_iter_del(it);
+
+    if (!found) { return lval_error("Function 'head' passed {}!"); }
+    if (v->type == LVAL_ERROR) { return v; }
+    return lval_add(lval_qexpr(), v);
+}
+
+lval* lseq_tail(lval* s) {
+
+    lseq* t = s->seq;
+
+    // Ranges and drops absorb the tail rather than growing the chain
+    if (t->kind == LSEQ_RANGE) {
+        lseq* r = lseq_new(LSEQ_RANGE, NULL);
+        r->step = t->step;
+        r->start = t->start + (t->n > 0 ? t->step : 0);
+        r->n = t->n > 0 ? t->n - 1 : 0;
+        return lval_seq(r);
+    }
+    if (t->kind == LSEQ_DROP) {
+        lseq* r = lseq_new(LSEQ_DROP, t->src);
+        r->n = t->n + 1;
+        return lval_seq(r);
+    }
+
+    lseq* r = lseq_new(LSEQ_DROP, t);
+    r->n = 1;
+    return lval_seq(r);
+}
+
+lval* lseq_len(lenv* e, lval* s) {
+
+    long n = lseq_count(s->seq);
+    if (n >= 0) { return lval_num(n); }
+
+    // Filtered sequences have to be pulled through
+    lseq_iter* it = lseq_iter_new(s->seq);
+    lval* v = NULL;
+    n = 0;
+    while (lseq_next(e, it, &v)) {
+        if (v->type == LVAL_ERROR) {
+            lseq_iter_del(it);
+            return v;
+        }
+        lval_del(v);
+        n++;
+    }
+    lseq_iter_del(it);
+    return lval_num(n);
+}
+
+lval* lseq_map(lval* f, lval* s) {
+    lseq* r = lseq_new(LSEQ_MAP, s->seq);
+    r->f = lval_copy(f);
+    return lval_seq(r);
+}
+
+lval* lseq_filter(lval* p, lval* s) {
+    lseq* r = lseq_new(LSEQ_FILTER, s->seq);
+    r->f = lval_copy(p);
+    return lval_seq(r);
+}
+
+lval* lseq_take(long n, lval* s) {
+    lseq* r = lseq_new(LSEQ_TAKE, s->seq);
+    r->n = n > 0 ? n : 0;
+    return lval_seq(r);
+}
+
+/*
+** Consumers
+*/
+lval* lseq_fold(lenv* e, lval* f, lval* acc, lval* s) {
+
+    lseq_iter* it = lseq_iter_new(s->seq);
+    lval* v = NULL;
+    while (lseq_next(e, it, &v)) {
+        if (v->type == LVAL_ERROR) {
+            lval_del(acc);
+            acc = v;
+            break;
+        }
+        acc = lval_apply(e, lval_copy(f), lval_add(lval_add(lval_sexpr(), acc), v));
+        if (acc->type == LVAL_ERROR) { break; }
+    }
+    lseq_iter_del(it);
+    return acc;
+}
+
+lval* lseq_each(lenv* e, lval* f, lval* s) {
+
+    lseq_iter* it = lseq_iter_new(s->seq);
+    lval* v = NULL;
+    lval* r = lval_sexpr();
+    while (lseq_next(e, it, &v)) {
+        if (v->type != LVAL_ERROR) {
+            v = lval_apply(e, lval_copy(f), lval_add(lval_sexpr(), v));
+        }
+        if (v->type == LVAL_ERROR) {
+            lval_del(r);
+            r = v;
+            break;
+        }
+        lval_del(v);
+    }
+    lseq_iter_del(it);
+    return r;
+}
+
+/* Pull every element of s into a Q-Expression */
+lval* lseq_collect(lenv* e, lval* s) {
+
+    long n = lseq_count(s->seq);
+    lval* l = lval_qexpr();
+    if (n > 0) { l->cell = malloc(sizeof(lval*) * n); }
+
+    lseq_iter* it = lseq_iter_new(s->seq);
+    lval* v = NULL;
+    while (lseq_next(e, it, &v)) {
+        if (v->type == LVAL_ERROR) {
+            lval_del(l);
+            l = v;
+            break;
+        }
+        if (n >= 0) {
+            l->cell[l->count++] = v;
+        } else {
+            lval_add(l, v);
+        }
+    }
+    lseq_iter_del(it);
+    return l;
+}
+
+/*
+** Builtins
+*/
+
+/* Numbers from start up to (not including) end: range end, range start end [step] */
+static lval* num_range(double* x, int n) {
+
+    double start = n > 1 ? x[0] : 0;
+    double end = n > 1 ? x[1] : x[0];
+    double step = n > 2 ? x[2] : 1;
+
+    if (step == 0) { return lval_error("Function 'range' passed a step of 0"); }
+
+    // Saturated while still a double, as converting one out of range is undefined
+    double count = ceil((end - start) / step);
+
+    lseq* s = lseq_new(LSEQ_RANGE, NULL);
+    s->start = start;
+    s->step = step;
+    s->n = count > 0 ? (count < LONG_MAX ? (long)count : LONG_MAX) : 0;
+    return lval_seq(s);
+}
+
+/* Elements of a sequence as a Q-Expression; lists are returned as they are */
+static lval* span_collect(lenv* e, lval** x, int n) {
+
+    if (x[0]->type == LVAL_QEXPR) {
+        lval* l = x[0];
+        x[0] = NULL;
+        return l;
+    }
+    return lseq_collect(e, x[0]);
+}
+
+const lsig sig_range = { "range", 1, 3, { LARG_NUM }, LARG_SEQ, num_range, NULL };
+const lsig sig_collect = { "collect", 1, 1, { LARG_LIST }, LARG_QEXPR, NULL, span_collect };
+
+lval* builtin_range(lenv* e, lval* a) {
+    return lsig_call(e, &sig_range, a);
+}
+
+lval* builtin_collect(lenv* e, lval* a) {
+    return lsig_call(e, &sig_collect, a);
+}
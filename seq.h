@@ -0,0 +1,63 @@
+#ifndef SEQ_H_
+#define SEQ_H_
+
+#include "lval.h"
+
+/*
+** Lazy sequences
+**
+** A sequence is a recipe for its elements rather than the elements
+** themselves: a range, or a map, filter, take or drop of another sequence.
+** Elements are produced one at a time when a consumer (head, len, fold,
+** each, collect) pulls them, so a sequence of any length is walked in
+** constant memory. Taking the tail of a sequence forces nothing. A range
+** longer than LONG_MAX elements is cut to LONG_MAX of them.
+**
+** Recipes are immutable and shared between copies, so pulling elements
+** again recomputes them; functions passed to map and filter should be
+** pure.
+*/
+enum LSEQ_KIND { LSEQ_RANGE, LSEQ_MAP, LSEQ_FILTER, LSEQ_TAKE, LSEQ_DROP };
+
+struct lseq {
+    int refs;
+    int kind;
+    double start;  // First element of a range
+    double step;   // Difference between elements of a range
+    long n;        // Elements of a range, or count of a take or drop
+    lval* f;       // Function of a map or filter
+    lseq* src;     // Sequence a map, filter, take or drop draws from
+};
+
+lval* lval_seq(lseq* s);
+void lseq_release(lseq* s);
+
+/* Iterators over the elements of a sequence */
+typedef struct lseq_iter lseq_iter;
+
+lseq_iter* lseq_iter_new(lseq* s);
+void lseq_iter_del(lseq_iter* it);
+
+/* Pull the next element into *v; returns 0 once there are none. *v may be an error */
+int lseq_next(lenv* e, lseq_iter* it, lval** v);
+
+/* Operations on the sequence in s (borrowed) */
+lval* lseq_head(lenv* e, lval* s);
+lval* lseq_tail(lval* s);
+lval* lseq_len(lenv* e, lval* s);
+lval* lseq_map(lval* f, lval* s);
+lval* lseq_filter(lval* p, lval* s);
+lval* lseq_take(long n, lval* s);
+
+/* Consumers; fold consumes acc */
+lval* lseq_fold(lenv* e, lval* f, lval* acc, lval* s);
+lval* lseq_each(lenv* e, lval* f, lval* s);
+lval* lseq_collect(lenv* e, lval* s);
+
+/* Builtins */
+extern const lsig sig_range, sig_collect;
+
+lval* builtin_range(lenv* e, lval* a);
+lval* builtin_collect(lenv* e, lval* a);
+
+#endif // SEQ_H_
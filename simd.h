@@ -0,0 +1,87 @@
+#ifndef SIMD_H_
+#define SIMD_H_
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+** Vector registers
+**
+** Numeric kernels (vec.c, matrix.c) are written once against these macros,
+** which use AVX when compiled for it and SSE2 otherwise. Without SIMD a
+** register holds a single double.
+*/
+#if defined(__AVX__)
+#define LVEC_WIDTH 4
+typedef __m256d vreg;
+#define vload(p) _mm256_loadu_pd(p)
+#define vstore(p, v) _mm256_storeu_pd(p, v)
+#define vset1(x) _mm256_set1_pd(x)
+#define vzero() _mm256_setzero_pd()
+#define vadd(a, b) _mm256_add_pd(a, b)
+#define vsub(a, b) _mm256_sub_pd(a, b)
+#define vmul(a, b) _mm256_mul_pd(a, b)
+#define vdiv(a, b) _mm256_div_pd(a, b)
+#define vzeros(v) _mm256_movemask_pd(_mm256_cmp_pd(v, _mm256_setzero_pd(), _CMP_EQ_OQ))
+#ifdef __FMA__
+#define vfma(a, b, c) _mm256_fmadd_pd(a, b, c)
+#endif
+#elif defined(__SSE2__)
+#define LVEC_WIDTH 2
+typedef __m128d vreg;
+#define vload(p) _mm_loadu_pd(p)
+#define vstore(p, v) _mm_storeu_pd(p, v)
+#define vset1(x) _mm_set1_pd(x)
+#define vzero() _mm_setzero_pd()
+#define vadd(a, b) _mm_add_pd(a, b)
+#define vsub(a, b) _mm_sub_pd(a, b)
+#define vmul(a, b) _mm_mul_pd(a, b)
+#define vdiv(a, b) _mm_div_pd(a, b)
+#define vzeros(v) _mm_movemask_pd(_mm_cmpeq_pd(v, _mm_setzero_pd()))
+#else
+#define LVEC_WIDTH 1
+typedef double vreg;
+#define vload(p) (*(p))
+#define vstore(p, v) (*(p) = (v))
+#define vset1(x) (x)
+#define vzero() 0.0
+#define vadd(a, b) ((a) + (b))
+#define vsub(a, b) ((a) - (b))
+#define vmul(a, b) ((a) * (b))
+#define vdiv(a, b) ((a) / (b))
+#define vzeros(v) ((v) == 0)
+#endif
+
+/* a * b + c, fused where the target has it */
+#ifndef vfma
+#define vfma(a, b, c) vadd(vmul(a, b), c)
+#endif
+
+/*
+** Byte registers
+**
+** Text scanning (text.c) compares LBYTE_WIDTH bytes at a time: bmatch(p, c)
+** is a mask with bit i set where byte p[i] equals c, a register made by
+** bset1. This needs AVX2 for 32 bytes; without SIMD it is one byte.
+*/
+#if defined(__AVX2__)
+#define LBYTE_WIDTH 32
+typedef __m256i breg;
+#define bset1(c) _mm256_set1_epi8(c)
+#define bmatch(p, c) \
+    (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p)), c))
+#elif defined(__SSE2__)
+#define LBYTE_WIDTH 16
+typedef __m128i breg;
+#define bset1(c) _mm_set1_epi8(c)
+#define bmatch(p, c) \
+    (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p)), c))
+#else
+#define LBYTE_WIDTH 1
+typedef char breg;
+#define bset1(c) (c)
+#define bmatch(p, c) (unsigned)(*(p) == (c))
+#endif
+
+#endif // SIMD_H_
@@ -0,0 +1,401 @@
+#include "sort.h"
+#include "record.h"
+#include "seq.h"
+#include "str.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LSORT_RUN 16     // Runs sorted by insertion before merging
+#define LSORT_CHUNK 8192 // Fewest elements given to a thread
+
+/* Order preserving map of a number to an unsigned integer */
+static unsigned lsort_bits(float x) {
+    unsigned u;
+    memcpy(&u, &x, sizeof(u));
+    return u & 0x80000000u ? ~u : u | 0x80000000u;
+}
+
+int lval_cmp(lval* a, lval* b) {
+
+    if (a == b) { return 0; }
+    if (a->type != b->type) { return a->type < b->type ? -1 : 1; }
+
+    switch (a->type) {
+        case LVAL_NUM: {
+            unsigned x = lsort_bits(a->value);
+            unsigned y = lsort_bits(b->value);
+            return (x > y) - (x < y);
+        }
+        case LVAL_SYM:
+            return strcmp(a->sym, b->sym);
+        case LVAL_ERROR:
+            return strcmp(a->err, b->err);
+        case LVAL_REC: {
+            int c = strcmp(a->rec->name, b->rec->name);
+            if (c) { return c; }
+        }
+            /* fall through */
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            for (int i = 0; i < a->count && i < b->count; i++) {
+                int c = lval_cmp(a->cell[i], b->cell[i]);
+                if (c) { return c; }
+            }
+            return (a->count > b->count) - (a->count < b->count);
+        case LVAL_MAT:
+            if (a->rows != b->rows) { return a->rows < b->rows ? -1 : 1; }
+            if (a->cols != b->cols) { return a->cols < b->cols ? -1 : 1; }
+            /* fall through */
+        case LVAL_ARR:
+            for (int i = 0; i < a->count && i < b->count; i++) {
+                if (a->data[i] != b->data[i]) { return a->data[i] < b->data[i] ? -1 : 1; }
+            }
+            return (a->count > b->count) - (a->count < b->count);
+        case LVAL_STR: {
+            int c = memcmp(lval_str_bytes(a), lval_str_bytes(b),
+                           a->count < b->count ? a->count : b->count);
+            if (c) { return c; }
+            return (a->count > b->count) - (a->count < b->count);
+        }
+        case LVAL_BYTES: {
+            int c = memcmp(a->bytes, b->bytes, a->size < b->size ? a->size : b->size);
+            if (c) { return c; }
+            return (a->size > b->size) - (a->size < b->size);
+        }
+    }
+
+    // Functions, sequences and tables have no natural order
+    return a < b ? -1 : 1;
+}
+
+/*
+** Sorting a permutation
+**
+** Every routine below works on an array of element indices, so moving an
+** element is copying an int and the keys are only read. This also lets
+** worker threads share the keys without copying them.
+*/
+typedef struct {
+    lval** keys;    // Key of each element
+    unsigned* bits; // Radix key of each element (NULL unless all are numbers)
+} lsort_ctx;
+
+static int lsort_less(lsort_ctx* c, int a, int b) {
+    return c->bits ? c->bits[a] < c->bits[b] : lval_cmp(c->keys[a], c->keys[b]) < 0;
+}
+
+/* Merge sorted runs a and b into out, taking from a first on ties */
+static void lsort_merge(lsort_ctx* c, int* a, long na, int* b, long nb, int* out) {
+    long i = 0, j = 0, k = 0;
+    while (i < na && j < nb) {
+        out[k++] = lsort_less(c, b[j], a[i]) ? b[j++] : a[i++];
+    }
+    memcpy(out + k, a + i, sizeof(int) * (na - i));
+    memcpy(out + k + na - i, b + j, sizeof(int) * (nb - j));
+}
+
+static void lsort_merge_sort(lsort_ctx* c, int* x, int* tmp, long n) {
+
+    for (long lo = 0; lo < n; lo += LSORT_RUN) {
+        long hi = lo + LSORT_RUN < n ? lo + LSORT_RUN : n;
+        for (long i = lo + 1; i < hi; i++) {
+            int v = x[i];
+            long j = i;
+            while (j > lo && lsort_less(c, v, x[j-1])) { x[j] = x[j-1]; j--; }
+            x[j] = v;
+        }
+    }
+
+    int* src = x;
+    int* dst = tmp;
+    for (long w = LSORT_RUN; w < n; w *= 2) {
+        for (long lo = 0; lo < n; lo += 2 * w) {
+            long mid = lo + w < n ? lo + w : n;
+            long hi = lo + 2 * w < n ? lo + 2 * w : n;
+            lsort_merge(c, src + lo, mid - lo, src + mid, hi - mid, dst + lo);
+        }
+        int* t = src; src = dst; dst = t;
+    }
+    if (src != x) { memcpy(x, src, sizeof(int) * n); }
+}
+
+/* LSD radix sort on the radix keys, a byte at a time */
+static void lsort_radix(lsort_ctx* c, int* x, long n) {
+
+    // Key in the high half and index in the low half, so each pass moves
+    // one word per element
+    unsigned long* a = malloc(sizeof(unsigned long) * n);
+    unsigned long* b = malloc(sizeof(unsigned long) * n);
+    for (long i = 0; i < n; i++) {
+        a[i] = (unsigned long)c->bits[x[i]] << 32 | (unsigned)x[i];
+    }
+
+    for (int shift = 32; shift < 64; shift += 8) {
+        long count[256] = { 0 };
+        for (long i = 0; i < n; i++) { count[(a[i] >> shift) & 0xff]++; }
+
+        // A byte every key shares leaves the order as it is
+        if (count[(a[0] >> shift) & 0xff] == n) { continue; }
+
+        long pos = 0;
+        for (int d = 0; d < 256; d++) {
+            long k = count[d];
+            count[d] = pos;
+            pos += k;
+        }
+        for (long i = 0; i < n; i++) { b[count[(a[i] >> shift) & 0xff]++] = a[i]; }
+
+        unsigned long* t = a; a = b; b = t;
+    }
+
+    for (long i = 0; i < n; i++) { x[i] = (int)(a[i] & 0xffffffffUL); }
+    free(a);
+    free(b);
+}
+
+static void lsort_chunk(lsort_ctx* c, int* x, int* tmp, long n) {
+    if (c->bits) {
+        lsort_radix(c, x, n);
+    } else {
+        lsort_merge_sort(c, x, tmp, n);
+    }
+}
+
+/*
+** Parallel sort
+**
+** The chunks are sorted concurrently, then merged pairwise in rounds. The
+** output of each merge is split evenly between the threads given to it;
+** each finds where its part starts in both inputs by binary search (the
+** co-rank of its first output position) and merges independently.
+*/
+typedef struct {
+    lsort_ctx* c;
+    int* a; long na; // Chunk to sort, or first run to merge
+    int* b; long nb; // Second run to merge
+    int* out;        // Sorting scratch, or merge output
+    long lo, hi;     // Part of the merge output to produce
+} lsort_task;
+
+/* Elements of a in the first k outputs of merging a and b */
+static long lsort_corank(lsort_ctx* c, long k, int* a, long na, int* b, long nb) {
+    long lo = k > nb ? k - nb : 0;
+    long hi = k < na ? k : na;
+    while (lo < hi) {
+        long i = (lo + hi) / 2;
+        if (!lsort_less(c, b[k - i - 1], a[i])) { lo = i + 1; } else { hi = i; }
+    }
+    return lo;
+}
+
+static void* lsort_chunk_thread(void* p) {
+    lsort_task* t = p;
+    lsort_chunk(t->c, t->a, t->out, t->na);
+    return NULL;
+}
+
+static void* lsort_merge_thread(void* p) {
+    lsort_task* t = p;
+    long i0 = lsort_corank(t->c, t->lo, t->a, t->na, t->b, t->nb);
+    long i1 = lsort_corank(t->c, t->hi, t->a, t->na, t->b, t->nb);
+    lsort_merge(t->c, t->a + i0, i1 - i0, t->b + (t->lo - i0), (t->hi - i1) - (t->lo - i0), t->out + t->lo);
+    return NULL;
+}
+
+/* Run every task on its own thread, or inline if one can't be started */
+static void lsort_run(void* (*f)(void*), lsort_task* tasks, int n) {
+    pthread_t* ids = malloc(sizeof(pthread_t) * n);
+    int* started = calloc(n, sizeof(int));
+    for (int i = 0; i < n; i++) {
+        started[i] = pthread_create(&ids[i], NULL, f, &tasks[i]) == 0;
+        if (!started[i]) { f(&tasks[i]); }
+    }
+    for (int i = 0; i < n; i++) {
+        if (started[i]) { pthread_join(ids[i], NULL); }
+    }
+    free(started);
+    free(ids);
+}
+
+static int lsort_threads(long n) {
+    long t = lval_threads > 0 ? lval_threads : sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < LSORT_PARALLEL || t < 1) { return 1; }
+    if (t > n / LSORT_CHUNK) { t = n / LSORT_CHUNK; }
+    return (int)t;
+}
+
+static void lsort_sort(lsort_ctx* c, int* x, long n) {
+
+    int* tmp = malloc(sizeof(int) * (n ? n : 1));
+    int t = lsort_threads(n);
+
+    if (t == 1) {
+        lsort_chunk(c, x, tmp, n);
+        free(tmp);
+        return;
+    }
+
+    long* bound = malloc(sizeof(long) * (t + 1));
+    lsort_task* tasks = calloc(t, sizeof(lsort_task));
+    for (int k = 0; k <= t; k++) { bound[k] = n * k / t; }
+
+    for (int k = 0; k < t; k++) {
+        tasks[k] = (lsort_task){ c, x + bound[k], bound[k+1] - bound[k], NULL, 0, tmp + bound[k], 0, 0 };
+    }
+    lsort_run(lsort_chunk_thread, tasks, t);
+
+    int* src = x;
+    int* dst = tmp;
+    for (int runs = t; runs > 1; runs = (runs + 1) / 2) {
+
+        int pairs = runs / 2;
+        int parts = t / pairs;
+        int ntasks = 0;
+
+        for (int p = 0; p < pairs; p++) {
+            long lo = bound[2*p], mid = bound[2*p+1], hi = bound[2*p+2];
+            for (int q = 0; q < parts; q++) {
+                tasks[ntasks++] = (lsort_task){ c, src + lo, mid - lo, src + mid, hi - mid,
+                    dst + lo, (hi - lo) * q / parts, (hi - lo) * (q + 1) / parts };
+            }
+        }
+
+        // An odd run out waits for the next round
+        if (runs % 2) {
+            memcpy(dst + bound[runs-1], src + bound[runs-1], sizeof(int) * (n - bound[runs-1]));
+        }
+
+        lsort_run(lsort_merge_thread, tasks, ntasks);
+
+        for (int p = 0; p < pairs; p++) { bound[p] = bound[2*p]; }
+        if (runs % 2) { bound[pairs] = bound[runs-1]; }
+        bound[(runs + 1) / 2] = n;
+
+        int* s = src; src = dst; dst = s;
+    }
+    if (src != x) { memcpy(x, src, sizeof(int) * n); }
+
+    free(tasks);
+    free(bound);
+    free(tmp);
+}
+
+/* Flatten the ropes of the strings in key k, nested ones included, since
+** reading a rope flattens it in place and sort threads share the keys */
+static void lsort_flatten(lval* k) {
+
+    int cap = 16, n = 0;
+    lval** stack = malloc(sizeof(lval*) * cap);
+    stack[n++] = k;
+
+    while (n) {
+        lval* v = stack[--n];
+        if (v->type == LVAL_STR) { lval_str_bytes(v); }
+        if (v->type != LVAL_QEXPR && v->type != LVAL_SEXPR && v->type != LVAL_REC) { continue; }
+        if (n + v->count > cap) {
+            cap = (n + v->count) * 2;
+            stack = realloc(stack, sizeof(lval*) * cap);
+        }
+        for (int i = 0; i < v->count; i++) { stack[n++] = v->cell[i]; }
+    }
+
+    free(stack);
+}
+
+/* Elements of l (consumed) in the order of their keys */
+static lval* lsort_list(lval* l, lval** keys) {
+
+    lsort_ctx c = { keys, NULL };
+    size_t size = l->count > 0 ? (size_t)l->count : 1;
+
+    // Numbers are sorted on their radix keys alone
+    int numbers = 1;
+    for (int i = 0; i < l->count && numbers; i++) { numbers = keys[i]->type == LVAL_NUM; }
+    if (numbers && l->count) {
+        c.bits = malloc(sizeof(unsigned) * size);
+        for (int i = 0; i < l->count; i++) { c.bits[i] = lsort_bits(keys[i]->value); }
+    }
+
+    // Before any threads start comparing them
+    if (!numbers && lsort_threads(l->count) > 1) {
+        for (int i = 0; i < l->count; i++) { lsort_flatten(keys[i]); }
+    }
+
+    int* idx = malloc(sizeof(int) * size);
+    for (int i = 0; i < l->count; i++) { idx[i] = i; }
+    lsort_sort(&c, idx, l->count);
+
+    // The cells of a list nothing else refers to are reordered in place
+    lval* out = l;
+    if (l->refs > 0) {
+        out = lval_qexpr();
+        out->count = l->count;
+    }
+    lval** cells = malloc(sizeof(lval*) * size);
+    for (int i = 0; i < l->count; i++) {
+        cells[i] = out == l ? l->cell[idx[i]] : lval_copy(l->cell[idx[i]]);
+    }
+    free(out->cell);
+    out->cell = cells;
+    if (out != l) { lval_del(l); }
+
+    free(idx);
+    free(c.bits);
+    return out;
+}
+
+/* List x[i], collected first if it is a sequence; x[i] is taken */
+static lval* lsort_elements(lenv* e, lval** x, int i) {
+    lval* l = x[i]->type == LVAL_SEQ ? lseq_collect(e, x[i]) : x[i];
+    if (l == x[i]) { x[i] = NULL; }
+    return l;
+}
+
+/*
+** Builtins
+*/
+
+/* Sort the elements: sort xs */
+static lval* span_sort(lenv* e, lval** x, int n) {
+    lval* l = lsort_elements(e, x, 0);
+    if (l->type == LVAL_ERROR) { return l; }
+    return lsort_list(l, l->cell);
+}
+
+/* Sort the elements by a key computed once for each: sort-by f xs */
+static lval* span_sort_by(lenv* e, lval** x, int n) {
+
+    lval* l = lsort_elements(e, x, 1);
+    if (l->type == LVAL_ERROR) { return l; }
+
+    lval** keys = malloc(sizeof(lval*) * (l->count ? l->count : 1));
+    for (int i = 0; i < l->count; i++) {
+        keys[i] = lval_apply(e, lval_copy(x[0]), lval_add(lval_sexpr(), lval_copy(l->cell[i])));
+        if (keys[i]->type == LVAL_ERROR) {
+            lval* err = keys[i];
+            for (int j = 0; j < i; j++) { lval_del(keys[j]); }
+            free(keys);
+            lval_del(l);
+            return err;
+        }
+    }
+
+    int count = l->count;
+    lval* out = lsort_list(l, keys);
+    for (int i = 0; i < count; i++) { lval_del(keys[i]); }
+    free(keys);
+    return out;
+}
+
+const lsig sig_sort = { "sort", 1, 1, { LARG_LIST }, LARG_QEXPR, NULL, span_sort };
+const lsig sig_sort_by = { "sort-by", 2, 2, { LARG_FUN, LARG_LIST }, LARG_QEXPR, NULL, span_sort_by };
+
+lval* builtin_sort(lenv* e, lval* a) {
+    return lsig_call(e, &sig_sort, a);
+}
+
+lval* builtin_sort_by(lenv* e, lval* a) {
+    return lsig_call(e, &sig_sort_by, a);
+}
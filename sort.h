@@ -0,0 +1,31 @@
+#ifndef SORT_H_
+#define SORT_H_
+
+#include "lval.h"
+
+/*
+** Sorting
+**
+**     sort xs         elements in ascending order
+**     sort-by f xs    elements in ascending order of f x
+**
+** Both are stable. The cell array is sorted through a permutation of its
+** indices: with an LSD radix sort when every key is a number, and a
+** bottom-up merge sort comparing keys with lval_cmp otherwise. Lists of at
+** least LSORT_PARALLEL elements are split into chunks sorted by worker
+** threads (lval_threads of them), which then merge the chunks pairwise,
+** splitting each merge between themselves. Keys of sort-by are computed
+** before any thread starts, since evaluation is single threaded.
+*/
+#define LSORT_PARALLEL 65536
+
+/* Total order on values: by type, then numerically, by name or element-wise */
+int lval_cmp(lval* a, lval* b);
+
+/* Builtins */
+extern const lsig sig_sort, sig_sort_by;
+
+lval* builtin_sort(lenv* e, lval* a);
+lval* builtin_sort_by(lenv* e, lval* a);
+
+#endif // SORT_H_
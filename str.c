@@ -0,0 +1,289 @@
+#include "str.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/*
+** String nodes
+*/
+
+/* Flat node owning the n bytes at buf */
+static lstr* lstr_adopt(char* buf, long n) {
+    lstr* s = calloc(1, sizeof(lstr));
+    s->refs = 1;
+    s->len = n;
+    s->bytes = buf;
+    return s;
+}
+
+/* Flat node with a copy of the n bytes at b */
+static lstr* lstr_flat(const char* b, long n) {
+    char* buf = malloc(n ? n : 1);
+    memcpy(buf, b, n);
+    return lstr_adopt(buf, n);
+}
+
+void lstr_release(lstr* s) {
+    if (--s->refs > 0) { return; }
+    if (s->left) {
+        lstr_release(s->left);
+        lstr_release(s->right);
+    }
+    if (s->base) {
+        lstr_release(s->base);
+    } else {
+        free(s->bytes);
+    }
+    free(s);
+}
+
+/* Copy bytes i up to i + n of s to out, without flattening s */
+static void lstr_read(lstr* s, long i, long n, char* out) {
+    while (s->left) {
+        long l = s->left->len;
+        if (i + n <= l) {
+            s = s->left;
+        } else if (i >= l) {
+            i -= l;
+            s = s->right;
+        } else {
+            lstr_read(s->left, i, l - i, out);
+            out += l - i;
+            n -= l - i;
+            i = 0;
+            s = s->right;
+        }
+    }
+    memcpy(out, s->bytes + i, n);
+}
+
+/* Contents of s, flattening it first if it is a rope */
+static const char* lstr_bytes(lstr* s) {
+    if (!s->left) { return s->bytes; }
+
+    char* buf = malloc(s->len);
+    lstr_read(s, 0, s->len, buf);
+    lstr_release(s->left);
+    lstr_release(s->right);
+    s->left = s->right = NULL;
+    s->depth = 0;
+    s->bytes = buf;
+    return buf;
+}
+
+/* Rope of a followed by b; consumes both */
+static lstr* lstr_concat(lstr* a, lstr* b) {
+    lstr* s = calloc(1, sizeof(lstr));
+    s->refs = 1;
+    s->len = a->len + b->len;
+    s->depth = (a->depth > b->depth ? a->depth : b->depth) + 1;
+    s->left = a;
+    s->right = b;
+    if (s->depth > LSTR_DEPTH) { lstr_bytes(s); }
+    return s;
+}
+
+/* Balanced rope over parts lo up to hi; consumes them */
+static lstr* lstr_balance(lstr** parts, int lo, int hi) {
+    if (hi - lo == 1) { return parts[lo]; }
+    int mid = lo + (hi - lo) / 2;
+    return lstr_concat(lstr_balance(parts, lo, mid), lstr_balance(parts, mid, hi));
+}
+
+/* View of bytes i up to i + n of s, sharing its bytes */
+static lstr* lstr_slice(lstr* s, long i, long n) {
+
+    // Descend into the half of a rope holding the whole range
+    while (s->left) {
+        long l = s->left->len;
+        if (i + n <= l) {
+            s = s->left;
+        } else if (i >= l) {
+            i -= l;
+            s = s->right;
+        } else {
+            break;
+        }
+    }
+    if (i == 0 && n == s->len) {
+        s->refs++;
+        return s;
+    }
+
+    // A range spanning both halves of a rope needs it flat
+    const char* b = lstr_bytes(s);
+    lstr* v = calloc(1, sizeof(lstr));
+    v->refs = 1;
+    v->len = n;
+    v->base = s->base ? s->base : s;
+    v->base->refs++;
+    v->bytes = (char*)b + i;
+    return v;
+}
+
+/*
+** String values
+*/
+lval* lval_str(const char* s, long n) {
+    lval* v = calloc(1, sizeof(lval));
+    v->type = LVAL_STR;
+    v->count = n;
+    if (n <= LSTR_INLINE) {
+        memcpy(v->sso, s, n);
+    } else {
+        v->str = lstr_flat(s, n);
+    }
+    return v;
+}
+
+/* String value of node s; consumes s */
+static lval* lval_lstr(lstr* s) {
+    if (s->len <= LSTR_INLINE) {
+        lval* v = calloc(1, sizeof(lval));
+        v->type = LVAL_STR;
+        v->count = s->len;
+        lstr_read(s, 0, s->len, v->sso);
+        lstr_release(s);
+        return v;
+    }
+    lval* v = calloc(1, sizeof(lval));
+    v->type = LVAL_STR;
+    v->count = s->len;
+    v->str = s;
+    return v;
+}
+
+lval* lval_str_own(char* buf, long n) {
+    if (n <= LSTR_INLINE) {
+        lval* v = lval_str(buf, n);
+        free(buf);
+        return v;
+    }
+    return lval_lstr(lstr_adopt(buf, n));
+}
+
+lval* lval_str_view(lval* s, long i, long n) {
+    if (n > LSTR_INLINE) { return lval_lstr(lstr_slice(s->str, i, n)); }
+
+    lval* v = lval_str("", 0);
+    v->count = n;
+    if (s->str) {
+        lstr_read(s->str, i, n, v->sso);
+    } else {
+        memcpy(v->sso, s->sso + i, n);
+    }
+    return v;
+}
+
+const char* lval_str_bytes(lval* v) {
+    return v->str ? lstr_bytes(v->str) : v->sso;
+}
+
+void lval_print_str(lval* v) {
+    const char* b = lval_str_bytes(v);
+    putchar('"');
+    for (long i = 0; i < v->count; i++) {
+        switch (b[i]) {
+            case '"': fputs("\\\"", stdout); break;
+            case '\\': fputs("\\\\", stdout); break;
+            case '\n': fputs("\\n", stdout); break;
+            case '\t': fputs("\\t", stdout); break;
+            case '\r': fputs("\\r", stdout); break;
+            default: putchar(b[i]);
+        }
+    }
+    putchar('"');
+}
+
+/*
+** Builtins
+*/
+
+/* Joined parts, with sep between each: str-join {"a" "b"} ", " */
+static lval* span_str_join(lenv* e, lval** x, int n) {
+
+    lval* l = x[0];
+    lval* sep = n > 1 ? x[1] : NULL;
+    long total = 0;
+    for (int i = 0; i < l->count; i++) {
+        if (l->cell[i]->type != LVAL_STR) {
+            return lval_error("Function 'str-join' passed a list containing a non-string");
+        }
+        total += l->cell[i]->count + (i && sep ? sep->count : 0);
+    }
+
+    // Long parts become leaves of the rope as they are; runs of short ones
+    // are copied together into chunks between them
+    lstr** leaves = malloc(sizeof(lstr*) * (2 * l->count + 1));
+    int nleaves = 0;
+    char* chunk = NULL;
+    long used = 0, cap = 0;
+
+    for (int i = 0; i < 2 * l->count - 1; i++) {
+        lval* p = i % 2 == 0 ? l->cell[i / 2] : sep;
+        if (!p || p->count == 0) { continue; }
+
+        if (p->str && p->count >= LSTR_CHUNK && total > LSTR_INLINE) {
+            if (used) {
+                leaves[nleaves++] = lstr_adopt(chunk, used);
+                chunk = NULL;
+                used = cap = 0;
+            }
+            p->str->refs++;
+            leaves[nleaves++] = p->str;
+            continue;
+        }
+
+        if (used + p->count > cap) {
+            cap = (used + p->count) * 2;
+            chunk = realloc(chunk, cap);
+        }
+        if (p->str) {
+            lstr_read(p->str, 0, p->count, chunk + used);
+        } else {
+            memcpy(chunk + used, p->sso, p->count);
+        }
+        used += p->count;
+    }
+    if (used) { leaves[nleaves++] = lstr_adopt(chunk, used); }
+
+    lval* r = nleaves ? lval_lstr(lstr_balance(leaves, 0, nleaves)) : lval_str("", 0);
+    free(leaves);
+    return r;
+}
+
+/* Bytes i up to j (or the end) of a string: substr s i [j] */
+static lval* span_substr(lenv* e, lval** x, int n) {
+
+    lval* s = x[0];
+    double i = x[1]->value;
+    double j = n > 2 ? x[2]->value : s->count;
+    /* Range-check as doubles first: casting NaN or a huge value is undefined */
+    if (!(i >= 0 && i <= j && j <= s->count) || i != floor(i) || j != floor(j)) {
+        return lval_error("Function 'substr' passed an index out of range");
+    }
+
+    return lval_str_view(s, (long)i, (long)j - (long)i);
+}
+
+/* Length of a string in bytes */
+static lval* span_str_len(lenv* e, lval** x, int n) {
+    return lval_num(x[0]->count);
+}
+
+const lsig sig_str_join = { "str-join", 1, 2, { LARG_QEXPR, LARG_STR }, LARG_STR, NULL, span_str_join };
+const lsig sig_substr = { "substr", 2, 3, { LARG_STR, LARG_NUM, LARG_NUM }, LARG_STR, NULL, span_substr };
+const lsig sig_str_len = { "str-len", 1, 1, { LARG_STR }, LARG_NUM, NULL, span_str_len };
+
+lval* builtin_str_join(lenv* e, lval* a) {
+    return lsig_call(e, &sig_str_join, a);
+}
+
+lval* builtin_substr(lenv* e, lval* a) {
+    return lsig_call(e, &sig_substr, a);
+}
+
+lval* builtin_str_len(lenv* e, lval* a) {
+    return lsig_call(e, &sig_str_len, a);
+}
@@ -0,0 +1,70 @@
+#ifndef STR_H_
+#define STR_H_
+
+#include "lval.h"
+
+/*
+** Strings
+**
+**     "hello\n"                 literal
+**     str-join {"a" "b"} [sep]   concatenation, with sep between the parts
+**     substr s i [j]             bytes i up to (not including) j
+**     str-len s                  length in bytes
+**
+** A string of up to LSTR_INLINE bytes is stored inside its lval (sso) and
+** never allocates. A longer one refers to a shared, immutable lstr, which
+** is one of:
+**
+**   - flat: its bytes in a buffer of its own
+**   - a slice: a view into the bytes of another flat string
+**   - a rope: the concatenation of two strings, with no bytes of its own
+**
+** Joining long strings builds a balanced rope over them instead of copying
+** them, and taking a substring of a flat string makes a slice. A rope is
+** flattened, in place and once, the first time its bytes are read as a
+** whole (printing, hashing, comparing); a rope deeper than LSTR_DEPTH is
+** flattened as soon as it is built. As that writes to a shared lstr, code
+** reading strings from several threads flattens them all first (see the
+** threaded sort in sort.c).
+**
+** Lengths and positions count bytes.
+*/
+#define LSTR_DEPTH 48
+#define LSTR_CHUNK 64 // Shorter parts of a join are copied into shared chunks
+
+struct lstr {
+    int refs;
+    long len;
+    int depth;      // Height of a rope (0 once flat)
+    lstr* left;     // Halves of a rope (NULL once flat)
+    lstr* right;
+    lstr* base;     // String a slice views (NULL unless a slice)
+    char* bytes;    // Contents when flat, owned unless this is a slice
+};
+
+void lstr_release(lstr* s);
+
+/* String of the n bytes at s (copied) */
+lval* lval_str(const char* s, long n);
+
+/* String of the n bytes at buf, taking ownership of buf (from malloc) */
+lval* lval_str_own(char* buf, long n);
+
+/* Bytes i up to i + n of string s, sharing its bytes rather than copying
+** them unless the result is short enough to store inline */
+lval* lval_str_view(lval* s, long i, long n);
+
+/* Contents of string v, contiguous but not NUL terminated (borrowed) */
+const char* lval_str_bytes(lval* v);
+
+/* Print v as a quoted literal, escaped so it reads back the same */
+void lval_print_str(lval* v);
+
+/* Builtins */
+extern const lsig sig_str_join, sig_substr, sig_str_len;
+
+lval* builtin_str_join(lenv* e, lval* a);
+lval* builtin_substr(lenv* e, lval* a);
+lval* builtin_str_len(lenv* e, lval* a);
+
+#endif // STR_H_
@@ -0,0 +1,168 @@
+#include "text.h"
+#include "str.h"
+#include "simd.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+** Scanning
+*/
+
+/* Position of the first byte c in h from i up to n, or n if there is none */
+static long ltext_chr(const char* h, long i, long n, char c) {
+    breg b = bset1(c);
+    for (; i + LBYTE_WIDTH <= n; i += LBYTE_WIDTH) {
+        unsigned bits = bmatch(h + i, b);
+        if (bits) { return i + __builtin_ctz(bits); }
+    }
+    for (; i < n; i++) {
+        if (h[i] == c) { return i; }
+    }
+    return n;
+}
+
+long ltext_count_chr(const char* h, long n, char c) {
+    breg b = bset1(c);
+    long count = 0, i = 0;
+    for (; i + LBYTE_WIDTH <= n; i += LBYTE_WIDTH) { count += __builtin_popcount(bmatch(h + i, b)); }
+    for (; i < n; i++) { count += h[i] == c; }
+    return count;
+}
+
+long ltext_find(const char* h, long i, long n, const char* p, long m) {
+
+    if (m == 0) { return i; }
+    if (m == 1) { return ltext_chr(h, i, n, p[0]); }
+
+    // Offsets where the first and last bytes both match are candidates
+    breg first = bset1(p[0]);
+    breg last = bset1(p[m - 1]);
+    for (; i + m - 1 + LBYTE_WIDTH <= n; i += LBYTE_WIDTH) {
+        unsigned bits = bmatch(h + i, first) & bmatch(h + i + m - 1, last);
+        for (; bits; bits &= bits - 1) {
+            long j = i + __builtin_ctz(bits);
+            if (memcmp(h + j + 1, p + 1, m - 2) == 0) { return j; }
+        }
+    }
+    for (; i + m <= n; i++) {
+        if (h[i] == p[0] && memcmp(h + i, p, m) == 0) { return i; }
+    }
+    return n;
+}
+
+/*
+** Builtins
+*/
+
+/* Pieces of a string between each separator: split "a,b" "," */
+static lval* span_split(lenv* e, lval** x, int n) {
+
+    lval* s = x[0];
+    lval* sep = x[1];
+    if (sep->count == 0) { return lval_error("Function 'split' passed an empty separator"); }
+
+    const char* h = lval_str_bytes(s);
+    const char* p = lval_str_bytes(sep);
+
+    lval* out = lval_qexpr();
+    int cap = 16;
+    out->cell = malloc(sizeof(lval*) * cap);
+
+    long i = 0;
+    while (1) {
+        long j = ltext_find(h, i, s->count, p, sep->count);
+        if (out->count == cap) {
+            cap *= 2;
+            out->cell = realloc(out->cell, sizeof(lval*) * cap);
+        }
+        out->cell[out->count++] = lval_str_view(s, i, j - i);
+        if (j == s->count) { break; }
+        i = j + sep->count;
+    }
+    return out;
+}
+
+/* Position of the first occurrence of a pattern, or -1: find s "ab" */
+static lval* span_find(lenv* e, lval** x, int n) {
+    lval* s = x[0];
+    long j = ltext_find(lval_str_bytes(s), 0, s->count, lval_str_bytes(x[1]), x[1]->count);
+    return lval_num(j + x[1]->count <= s->count ? j : -1);
+}
+
+/* Number of non-overlapping occurrences of a pattern: count s "ab" */
+static lval* span_count(lenv* e, lval** x, int n) {
+
+    lval* s = x[0];
+    lval* pat = x[1];
+    if (pat->count == 0) { return lval_error("Function 'count' passed an empty pattern"); }
+
+    const char* h = lval_str_bytes(s);
+    const char* p = lval_str_bytes(pat);
+    if (pat->count == 1) { return lval_num(ltext_count_chr(h, s->count, p[0])); }
+
+    long c = 0;
+    for (long i = ltext_find(h, 0, s->count, p, pat->count); i < s->count;
+         i = ltext_find(h, i + pat->count, s->count, p, pat->count)) {
+        c++;
+    }
+    return lval_num(c);
+}
+
+/* Every occurrence of a pattern replaced: replace s "ab" "c" */
+static lval* span_replace(lenv* e, lval** x, int n) {
+
+    lval* s = x[0];
+    lval* pat = x[1];
+    lval* with = x[2];
+    if (pat->count == 0) { return lval_error("Function 'replace' passed an empty pattern"); }
+
+    const char* h = lval_str_bytes(s);
+    const char* p = lval_str_bytes(pat);
+    const char* w = lval_str_bytes(with);
+
+    long j = ltext_find(h, 0, s->count, p, pat->count);
+    if (j == s->count) {
+        x[0] = NULL;
+        return s;
+    }
+
+    long cap = s->count + (with->count > pat->count ? with->count - pat->count : 0) + 1;
+    char* out = malloc(cap);
+    long used = 0, i = 0;
+    while (1) {
+        long need = used + (j - i) + with->count;
+        if (need > cap) {
+            cap = need * 2;
+            out = realloc(out, cap);
+        }
+        memcpy(out + used, h + i, j - i);
+        used += j - i;
+        if (j == s->count) { break; }
+        memcpy(out + used, w, with->count);
+        used += with->count;
+        i = j + pat->count;
+        j = ltext_find(h, i, s->count, p, pat->count);
+    }
+    return lval_str_own(out, used);
+}
+
+const lsig sig_split = { "split", 2, 2, { LARG_STR, LARG_STR }, LARG_QEXPR, NULL, span_split };
+const lsig sig_find = { "find", 2, 2, { LARG_STR, LARG_STR }, LARG_NUM, NULL, span_find };
+const lsig sig_count = { "count", 2, 2, { LARG_STR, LARG_STR }, LARG_NUM, NULL, span_count };
+const lsig sig_replace = { "replace", 3, 3, { LARG_STR, LARG_STR, LARG_STR }, LARG_STR, NULL, span_replace };
+
+lval* builtin_split(lenv* e, lval* a) {
+    return lsig_call(e, &sig_split, a);
+}
+
+lval* builtin_find(lenv* e, lval* a) {
+    return lsig_call(e, &sig_find, a);
+}
+
+lval* builtin_count(lenv* e, lval* a) {
+    return lsig_call(e, &sig_count, a);
+}
+
+lval* builtin_replace(lenv* e, lval* a) {
+    return lsig_call(e, &sig_replace, a);
+}
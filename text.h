@@ -0,0 +1,37 @@
+#ifndef TEXT_H_
+#define TEXT_H_
+
+#include "lval.h"
+
+/*
+** Searching text
+**
+**     split s sep          Q-Expression of the pieces of s between each sep
+**     find s pat           position of the first pat in s, or -1
+**     count s pat          number of (non-overlapping) pats in s
+**     replace s pat new    s with every pat replaced by new
+**
+** These scan many bytes per instruction (see simd.h): a single byte is
+** found by comparing a whole register against it, and a longer pattern by
+** comparing its first and last bytes at every offset of a register at
+** once, so only offsets where both match are compared in full.
+**
+** The pieces returned by split are views of s (see str.h), so splitting
+** copies no more than the pieces short enough to store inline.
+*/
+
+/* Position of the first of the m bytes at p in h from i up to n, or n */
+long ltext_find(const char* h, long i, long n, const char* p, long m);
+
+/* Number of bytes c in h up to n */
+long ltext_count_chr(const char* h, long n, char c);
+
+/* Builtins */
+extern const lsig sig_split, sig_find, sig_count, sig_replace;
+
+lval* builtin_split(lenv* e, lval* a);
+lval* builtin_find(lenv* e, lval* a);
+lval* builtin_count(lenv* e, lval* a);
+lval* builtin_replace(lenv* e, lval* a);
+
+#endif // TEXT_H_
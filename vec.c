@@ -0,0 +1,226 @@
+#include "vec.h"
+#include "array.h"
+#include "matrix.h"
+#include "simd.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+** Kernels
+**
+** Each computes r = a op y over n elements, where either side may instead
+** be one number broadcast to all of them. r may be a itself.
+*/
+#define LVEC_KERNEL(name, vop, op)                                      \
+static void name(double* r, const double* a, const double* y, long n) { \
+    long i = 0;                                                         \
+    for (; i + LVEC_WIDTH <= n; i += LVEC_WIDTH) {                      \
+        vstore(r + i, vop(vload(a + i), vload(y + i)));                 \
+    }                                                                   \
+    for (; i < n; i++) { r[i] = a[i] op y[i]; }                         \
+}                                                                       \
+static void name##_vs(double* r, const double* a, double y, long n) {   \
+    vreg v = vset1(y);                                                  \
+    long i = 0;                                                         \
+    for (; i + LVEC_WIDTH <= n; i += LVEC_WIDTH) {                      \
+        vstore(r + i, vop(vload(a + i), v));                            \
+    }                                                                   \
+    for (; i < n; i++) { r[i] = a[i] op y; }                            \
+}                                                                       \
+static void name##_sv(double* r, double a, const double* y, long n) {   \
+    vreg v = vset1(a);                                                  \
+    long i = 0;                                                         \
+    for (; i + LVEC_WIDTH <= n; i += LVEC_WIDTH) {                      \
+        vstore(r + i, vop(v, vload(y + i)));                            \
+    }                                                                   \
+    for (; i < n; i++) { r[i] = a op y[i]; }                            \
+}
+
+LVEC_KERNEL(lvec_kernel_add, vadd, +)
+LVEC_KERNEL(lvec_kernel_sub, vsub, -)
+LVEC_KERNEL(lvec_kernel_mul, vmul, *)
+LVEC_KERNEL(lvec_kernel_div, vdiv, /)
+
+/* Whether any of the n elements at y is zero */
+static int lvec_has_zero(const double* y, long n) {
+    long i = 0;
+    for (; i + LVEC_WIDTH <= n; i += LVEC_WIDTH) {
+        if (vzeros(vload(y + i))) { return 1; }
+    }
+    for (; i < n; i++) {
+        if (y[i] == 0) { return 1; }
+    }
+    return 0;
+}
+
+/*
+** Broadcasting
+**
+** Arguments are combined left to right. Until the first list the result
+** is a single number; after it, n elements. A side which is a number is
+** passed as a pointer to it with its count 0.
+*/
+enum { LVEC_ADD, LVEC_SUB, LVEC_MUL, LVEC_DIV, LVEC_POW };
+
+/* r = a op y, where a has na elements and y has ny (0 for a number, else n) */
+static lval* lvec_combine(int op, double* r, const double* a, long na, const double* y, long ny, long n) {
+
+    if (op == LVEC_DIV && (ny ? lvec_has_zero(y, ny) : *y == 0)) {
+        return lval_error("Cannot divide by zero");
+    }
+
+    // Two numbers make a number
+    if (!na && !ny) {
+        switch (op) {
+            case LVEC_ADD: *r = *a + *y; break;
+            case LVEC_SUB: *r = *a - *y; break;
+            case LVEC_MUL: *r = *a * *y; break;
+            case LVEC_DIV: *r = *a / *y; break;
+            case LVEC_POW: *r = pow(*a, *y); break;
+        }
+        return NULL;
+    }
+
+#define LVEC_CASE(k, kernel)                                          \
+    case k:                                                           \
+        if (na && ny) { kernel(r, a, y, n); }                         \
+        else if (na) { kernel##_vs(r, a, *y, n); }                    \
+        else { kernel##_sv(r, *a, y, n); }                            \
+        break;
+
+    switch (op) {
+        LVEC_CASE(LVEC_ADD, lvec_kernel_add)
+        LVEC_CASE(LVEC_SUB, lvec_kernel_sub)
+        LVEC_CASE(LVEC_MUL, lvec_kernel_mul)
+        LVEC_CASE(LVEC_DIV, lvec_kernel_div)
+        case LVEC_POW:
+            for (long i = 0; i < n; i++) { r[i] = pow(na ? a[i] : *a, ny ? y[i] : *y); }
+            break;
+    }
+#undef LVEC_CASE
+    return NULL;
+}
+
+/* Elements of list v as doubles; Q-Expressions are unpacked into tmp */
+static const double* lvec_elements(lval* v, double* tmp) {
+    if (v->type == LVAL_ARR || v->type == LVAL_MAT) { return v->data; }
+    for (int i = 0; i < v->count; i++) { tmp[i] = v->cell[i]->value; }
+    return tmp;
+}
+
+static lval* lvec_apply(const char* name, int op, lval** x, int n) {
+
+    char err[128];
+
+    // Every list must hold only numbers and have the same length
+    long len = -1;
+    int arr = 0;
+    lval* mat = NULL;
+    for (int i = 0; i < n; i++) {
+        lval* v = x[i];
+        if (v->type == LVAL_NUM) { continue; }
+
+        for (int j = 0; v->type == LVAL_QEXPR && j < v->count; j++) {
+            if (v->cell[j]->type != LVAL_NUM) {
+                snprintf(err, sizeof(err), "Function '%s' passed a list containing a non-number", name);
+                return lval_error(err);
+            }
+        }
+        if (!mat && v->type == LVAL_MAT) { mat = v; }
+        if (len >= 0 && v->count != len) {
+            snprintf(err, sizeof(err), mat ? "Function '%s' passed matrices of different shapes"
+                     : "Function '%s' passed lists of different lengths", name);
+            return lval_error(err);
+        }
+        len = v->count;
+        arr = arr || v->type == LVAL_ARR;
+    }
+
+    // With a matrix, every list must be a matrix of the same shape
+    for (int i = 0; mat && i < n; i++) {
+        lval* v = x[i];
+        if (v->type == LVAL_NUM) { continue; }
+        if (v->type != LVAL_MAT || v->rows != mat->rows || v->cols != mat->cols) {
+            snprintf(err, sizeof(err), "Function '%s' passed matrices of different shapes", name);
+            return lval_error(err);
+        }
+    }
+
+    // The result is built in an array or matrix, taking over the first
+    // argument if it is one and nothing else shares its buffer
+    lval* first = x[0];
+    lval* out = NULL;
+    double* r;
+    if ((arr || mat) && first->type != LVAL_NUM && first->type != LVAL_QEXPR && first->buf->refs == 1) {
+        out = first;
+        x[0] = NULL;
+        r = out->data;
+    } else {
+        out = mat ? lval_matrix(mat->rows, mat->cols) : arr ? lval_array(len) : NULL;
+        r = out ? out->data : malloc(sizeof(double) * (len ? len : 1));
+    }
+    double* tmp = malloc(sizeof(double) * (len ? len : 1));
+
+    // Minus with a single argument subtracts it from zero
+    double acc = 0;
+    const double* a = &acc;
+    long na = 0;
+    int i = n == 1 && op == LVEC_SUB ? 0 : 1;
+    if (i == 1 && first->type == LVAL_NUM) {
+        acc = first->value;
+    } else if (i == 1) {
+        a = lvec_elements(first, r);
+        na = len;
+    }
+
+    lval* error = NULL;
+    for (; i < n && !error; i++) {
+        lval* v = x[i];
+        double y = v->type == LVAL_NUM ? v->value : 0;
+        long ny = v->type == LVAL_NUM ? 0 : len;
+        const double* ys = ny ? lvec_elements(v, tmp) : &y;
+
+        double* dst = na || ny ? r : &acc;
+        error = lvec_combine(op, dst, a, na, ys, ny, len);
+        a = dst;
+        na = na || ny ? len : 0;
+    }
+    free(tmp);
+
+    if (!error && a != r) { memcpy(r, a, sizeof(double) * len); }
+
+    if (error) {
+        if (out) { lval_del(out); } else { free(r); }
+        return error;
+    }
+    if (out) { return out; }
+
+    lval* q = lval_qexpr();
+    q->count = len;
+    q->cell = malloc(sizeof(lval*) * len);
+    for (long i = 0; i < len; i++) { q->cell[i] = lval_num(r[i]); }
+    free(r);
+    return q;
+}
+
+lval* lvec_add(lenv* e, lval** x, int n) {
+    return lvec_apply("+", LVEC_ADD, x, n);
+}
+
+lval* lvec_sub(lenv* e, lval** x, int n) {
+    return lvec_apply("-", LVEC_SUB, x, n);
+}
+
+lval* lvec_mul(lenv* e, lval** x, int n) {
+    return lvec_apply("*", LVEC_MUL, x, n);
+}
+
+lval* lvec_div(lenv* e, lval** x, int n) {
+    return lvec_apply("/", LVEC_DIV, x, n);
+}
+
+lval* lvec_pow(lenv* e, lval** x, int n) {
+    return lvec_apply("^", LVEC_POW, x, n);
+}
@@ -0,0 +1,32 @@
+#ifndef VEC_H_
+#define VEC_H_
+
+#include "lval.h"
+
+/*
+** Element-wise arithmetic
+**
+**     + {1 2 3} {10 20 30}    {11 22 33}
+**     * 2 [1 2 3]             [2 4 6]
+**
+** When any argument of + - * / ^ is a Q-Expression or an array of numbers
+** the operator is applied element by element, with every number argument
+** repeated to the length of the lists (broadcast). All list arguments must
+** have the same length. The result is an array if any argument is one, and
+** a Q-Expression otherwise. Matrices combine only with numbers and with
+** matrices of the same shape, giving a matrix. (See the README for the
+** full rules.)
+**
+** Elements are unpacked to doubles and combined a vector register at a
+** time (AVX when compiled for it, SSE2 otherwise), one argument after
+** another, in a single result buffer.
+*/
+
+/* Span entry points of the arithmetic builtins, taking at least one list */
+lval* lvec_add(lenv* e, lval** x, int n);
+lval* lvec_sub(lenv* e, lval** x, int n);
+lval* lvec_mul(lenv* e, lval** x, int n);
+lval* lvec_div(lenv* e, lval** x, int n);
+lval* lvec_pow(lenv* e, lval** x, int n);
+
+#endif // VEC_H_